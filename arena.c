@@ -0,0 +1,92 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+static ArenaChunk *arena_new_chunk(ArenaChunk *next, size_t size) {
+    ArenaChunk *chunk = (ArenaChunk *)malloc(sizeof(ArenaChunk) + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = next;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaChunk *chunk = arena->head;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = arena_new_chunk(arena->head, chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        arena->head = chunk;
+    }
+
+    void *pointer = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->total += size;
+
+    return pointer;
+}
+
+char *arena_strdup(Arena *arena, const char *text) {
+    size_t len = strlen(text) + 1;
+    char *copy = (char *)arena_alloc(arena, len);
+    if (copy != NULL) {
+        memcpy(copy, text, len);
+    }
+    return copy;
+}
+
+// A request that overflowed the first chunk leaves a chain behind; it is
+// replaced by one chunk big enough for the whole request, so steady-state
+// traffic stops touching the heap after the first few requests. Requests
+// bigger than ARENA_KEEP_MAX keep allocating, but their memory goes back.
+void arena_reset(Arena *arena) {
+    ArenaChunk *chunk = arena->head;
+    if (chunk != NULL && (chunk->next != NULL || chunk->size > ARENA_KEEP_MAX)) {
+        size_t size = arena->total > ARENA_CHUNK_SIZE ? arena->total : ARENA_CHUNK_SIZE;
+        if (size > ARENA_KEEP_MAX) {
+            size = ARENA_KEEP_MAX;
+        }
+        arena_destroy(arena);
+        chunk = arena_new_chunk(NULL, size);
+        arena->head = chunk;
+    }
+    if (chunk != NULL) {
+        chunk->used = 0;
+    }
+    arena->total = 0;
+}
+
+void arena_destroy(Arena *arena) {
+    ArenaChunk *chunk = arena->head;
+    while (chunk != NULL) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->total = 0;
+}
+
+static void *arena_protobuf_alloc(void *allocator_data, size_t size) {
+    return arena_alloc((Arena *)allocator_data, size);
+}
+
+static void arena_protobuf_free(void *allocator_data, void *pointer) {
+    // Released together on arena_reset
+}
+
+ProtobufCAllocator *arena_allocator(Arena *arena) {
+    arena->allocator.alloc = arena_protobuf_alloc;
+    arena->allocator.free = arena_protobuf_free;
+    arena->allocator.allocator_data = arena;
+
+    return &arena->allocator;
+}
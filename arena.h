@@ -0,0 +1,38 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <protobuf-c/protobuf-c.h>
+
+#define ARENA_CHUNK_SIZE (16 * 1024)
+#define ARENA_ALIGNMENT 16
+// Largest chunk arena_reset holds on to; one oversized request should not
+// pin its memory for the life of the thread
+#define ARENA_KEEP_MAX (256 * 1024)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    // Three words of header would leave data 8-byte aligned
+    _Alignas(ARENA_ALIGNMENT) uint8_t data[];
+} ArenaChunk;
+
+// Bump allocator for everything a single request needs. Allocations are
+// never freed one by one; arena_reset drops them all at once and keeps the
+// memory for the next request. A zeroed Arena is ready to use.
+typedef struct Arena {
+    ArenaChunk *head;
+    size_t total; // bytes handed out since the last reset
+    ProtobufCAllocator allocator;
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *text);
+void arena_reset(Arena *arena);
+void arena_destroy(Arena *arena);
+// Allocator that makes protobuf-c unpack into the arena
+ProtobufCAllocator *arena_allocator(Arena *arena);
+
+#endif
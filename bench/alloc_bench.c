@@ -0,0 +1,126 @@
+// Heap allocations per request: decoding a UserOption and building its
+// Answer with the default protobuf-c allocator and malloc'd messages, as
+// server.c did before, vs. the per-thread request arena. Build from the
+// repository root with:
+//   gcc -O2 -I. bench/alloc_bench.c arena.c chat.pb-c.c -lprotobuf-c -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free -o alloc_bench
+// Usage: ./alloc_bench [peticiones]
+#define _POSIX_C_SOURCE 200809L
+#include "arena.h"
+#include "chat.pb-c.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// --wrap only reaches calls made from objects linked here, not from inside
+// libprotobuf-c, so the "before" path decodes with heap_allocator, which
+// does exactly what the library's default allocator does
+static unsigned long heap_calls = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void __real_free(void *pointer);
+
+void *__wrap_malloc(size_t size) { heap_calls++; return __real_malloc(size); }
+void *__wrap_calloc(size_t count, size_t size) { heap_calls++; return __real_calloc(count, size); }
+void *__wrap_realloc(void *pointer, size_t size) { heap_calls++; return __real_realloc(pointer, size); }
+void __wrap_free(void *pointer) { if (pointer != NULL) heap_calls++; __real_free(pointer); }
+
+static void *heap_alloc(void *allocator_data, size_t size) { return malloc(size); }
+static void heap_free(void *allocator_data, void *pointer) { free(pointer); }
+static ProtobufCAllocator heap_allocator = { heap_alloc, heap_free, NULL };
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What a request ends in either way: the Answer packed into a buffer that
+// outlives the request (a SharedBuffer in the server)
+static size_t pack_reply(ChatSistOS__Answer *answer) {
+    size_t len = chat_sist_os__answer__get_packed_size(answer);
+    uint8_t *packed = malloc(len);
+    chat_sist_os__answer__pack(answer, packed);
+    free(packed);
+    return len;
+}
+
+static size_t request_before(const uint8_t *data, size_t len) {
+    ChatSistOS__UserOption *option = chat_sist_os__user_option__unpack(&heap_allocator, len, data);
+    ChatSistOS__Message *message = malloc(sizeof(ChatSistOS__Message));
+    chat_sist_os__message__init(message);
+    message->message_content = strdup("Mensaje enviado a todos los usuarios");
+
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    answer.op = option->op;
+    answer.response_status_code = 200;
+    answer.message = message;
+    size_t packed = pack_reply(&answer);
+
+    free(message->message_content);
+    free(message);
+    chat_sist_os__user_option__free_unpacked(option, &heap_allocator);
+    return packed;
+}
+
+static size_t request_arena(Arena *arena, const uint8_t *data, size_t len) {
+    ChatSistOS__UserOption *option = chat_sist_os__user_option__unpack(arena_allocator(arena), len, data);
+    ChatSistOS__Message *message = arena_alloc(arena, sizeof(ChatSistOS__Message));
+    chat_sist_os__message__init(message);
+    message->message_content = arena_strdup(arena, "Mensaje enviado a todos los usuarios");
+
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    answer.op = option->op;
+    answer.response_status_code = 200;
+    answer.message = message;
+    size_t packed = pack_reply(&answer);
+
+    arena_reset(arena);
+    return packed;
+}
+
+int main(int argc, char *argv[]) {
+    int requests = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    // A broadcast, the most common request
+    ChatSistOS__Message message = CHAT_SIST_OS__MESSAGE__INIT;
+    message.message_content = "hola a todos, ¿cómo va la tarde?";
+    message.message_sender = "usuario_de_prueba";
+    ChatSistOS__UserOption option = CHAT_SIST_OS__USER_OPTION__INIT;
+    option.op = 4;
+    option.message = &message;
+    size_t len = chat_sist_os__user_option__get_packed_size(&option);
+    uint8_t *data = malloc(len);
+    chat_sist_os__user_option__pack(&option, data);
+
+    size_t sink = 0;
+    unsigned long calls = heap_calls;
+    double start = now_seconds();
+    for (int i = 0; i < requests; i++) {
+        sink += request_before(data, len);
+    }
+    double before_time = now_seconds() - start;
+    unsigned long before_calls = heap_calls - calls;
+
+    Arena arena = { 0 };
+    calls = heap_calls;
+    start = now_seconds();
+    for (int i = 0; i < requests; i++) {
+        sink += request_arena(&arena, data, len);
+    }
+    double arena_time = now_seconds() - start;
+    unsigned long arena_calls = heap_calls - calls;
+    arena_destroy(&arena);
+
+    printf("%d peticiones de %zu bytes, %zu bytes de respuesta\n", requests, len, sink);
+    printf("malloc + free:  %.2f llamadas al heap/petición, %.0f ns/petición\n",
+           (double)before_calls / requests, before_time * 1e9 / requests);
+    printf("arena:          %.2f llamadas al heap/petición, %.0f ns/petición\n",
+           (double)arena_calls / requests, arena_time * 1e9 / requests);
+    printf("(2 de ellas por petición son el búfer de salida, que sobrevive a la petición)\n");
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,251 @@
+// Fast-path request decoding: checks request_view_decode against
+// protobuf-c on random and mangled UserOptions, then times both on a chat
+// message. Build from the repository root with:
+//   gcc -O2 -I. bench/decode_bench.c request_view.c arena.c chat.pb-c.c -lprotobuf-c -o decode_bench
+// Usage: ./decode_bench [casos_fuzz] [decodificaciones]
+#define _POSIX_C_SOURCE 200809L
+#include "arena.h"
+#include "chat.pb-c.h"
+#include "request_view.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FUZZ_MAX_BYTES 512
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static unsigned rng_below(unsigned n) {
+    return (unsigned)(rng_next() % n);
+}
+
+typedef struct Writer {
+    uint8_t bytes[FUZZ_MAX_BYTES];
+    size_t len;
+} Writer;
+
+static void put_byte(Writer *out, uint8_t byte) {
+    if (out->len < FUZZ_MAX_BYTES) {
+        out->bytes[out->len++] = byte;
+    }
+}
+
+// Sometimes padded with redundant continuation bytes, up to past what
+// protobuf-c accepts
+static void put_varint(Writer *out, uint64_t value) {
+    int padding = rng_below(8) == 0 ? (int)rng_below(12) : 0;
+    while (value >= 0x80 || padding > 0) {
+        put_byte(out, (uint8_t)(value | 0x80));
+        value >>= 7;
+        if (value == 0) {
+            padding--;
+        }
+    }
+    put_byte(out, (uint8_t)value);
+}
+
+static void put_key(Writer *out, unsigned number, unsigned wire_type) {
+    put_varint(out, (uint64_t)number << 3 | wire_type);
+}
+
+static uint64_t random_value(void) {
+    switch (rng_below(5)) {
+    case 0: return 0;
+    case 1: return rng_below(10);
+    case 2: return (uint64_t)(int64_t)-(int64_t)rng_below(1000);
+    case 3: return rng_next();
+    default: return rng_below(1u << 20);
+    }
+}
+
+static void put_string(Writer *out, unsigned number) {
+    put_key(out, number, 2);
+    size_t len = rng_below(4) == 0 ? rng_below(200) : rng_below(24);
+    put_varint(out, len);
+    for (size_t i = 0; i < len; i++) {
+        // Mostly text, with the odd NUL and high byte
+        unsigned pick = rng_below(40);
+        put_byte(out, pick == 0 ? 0 : pick == 1 ? (uint8_t)(0x80 | rng_below(128)) : (uint8_t)('a' + rng_below(26)));
+    }
+}
+
+static void put_message(Writer *out) {
+    Writer body = { .len = 0 };
+    int fields = (int)rng_below(7);
+    for (int i = 0; i < fields; i++) {
+        unsigned number = 1 + rng_below(rng_below(6) == 0 ? 7 : 4);
+        if (number == 1 && rng_below(6) != 0) {
+            put_key(&body, 1, 0);
+            put_varint(&body, random_value());
+        } else if (number <= 4) {
+            put_string(&body, number);
+        } else {
+            put_key(&body, number, 0);
+            put_varint(&body, random_value());
+        }
+    }
+    put_key(out, 5, 2);
+    put_varint(out, body.len);
+    for (size_t i = 0; i < body.len; i++) {
+        put_byte(out, body.bytes[i]);
+    }
+}
+
+// A UserOption built field by field: mostly the op and message the fast
+// path takes, now and then something it has to hand over
+static void random_option(Writer *out) {
+    out->len = 0;
+    int fields = 1 + (int)rng_below(4);
+    for (int i = 0; i < fields; i++) {
+        unsigned pick = rng_below(12);
+        if (pick < 4) {
+            put_key(out, 1, 0);
+            put_varint(out, random_value());
+        } else if (pick < 9) {
+            put_message(out);
+        } else if (pick == 9) {
+            // Another request type: a Room
+            put_key(out, 6, 2);
+            put_varint(out, 0);
+        } else if (pick == 10) {
+            put_key(out, 20 + rng_below(100), 0);
+            put_varint(out, random_value());
+        } else {
+            put_string(out, 1);
+        }
+    }
+
+    // Then maybe break it
+    unsigned mangle = rng_below(4);
+    if (mangle == 0 && out->len > 0) {
+        out->bytes[rng_below((unsigned)out->len)] ^= (uint8_t)(1u << rng_below(8));
+    } else if (mangle == 1 && out->len > 0) {
+        out->len = rng_below((unsigned)out->len);
+    }
+}
+
+// The generic decoder NUL-terminates its copies, so that is all the
+// server ever sees of a string with a NUL inside
+static int same_string(StringView view, const char *text) {
+    size_t len = strnlen(view.data, view.len);
+    return strlen(text) == len && memcmp(view.data, text, len) == 0;
+}
+
+static int same_result(const RequestView *view, const ChatSistOS__UserOption *option) {
+    if (option->op != view->op || (option->message != NULL) != view->has_message) {
+        return 0;
+    }
+    if (option->createuser != NULL || option->userlist != NULL || option->status != NULL ||
+        option->room != NULL || option->history != NULL) {
+        return 0;
+    }
+    if (!view->has_message) {
+        return 1;
+    }
+    const ChatSistOS__Message *message = option->message;
+    return (message->message_private != 0) == view->message.message_private &&
+           same_string(view->message.message_destination, message->message_destination) &&
+           same_string(view->message.message_content, message->message_content) &&
+           same_string(view->message.message_sender, message->message_sender);
+}
+
+static int fuzz(long cases) {
+    long fast = 0;
+    long generic = 0;
+    long mismatches = 0;
+    Writer input;
+    for (long i = 0; i < cases; i++) {
+        random_option(&input);
+        RequestView view;
+        int decoded = request_view_decode(input.bytes, input.len, &view);
+        ChatSistOS__UserOption *option = chat_sist_os__user_option__unpack(NULL, input.len, input.bytes);
+        fast += decoded;
+        generic += option != NULL;
+        if (decoded && (option == NULL || !same_result(&view, option))) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "Diferencia en el caso %ld (%zu bytes):", i, input.len);
+                for (size_t b = 0; b < input.len; b++) {
+                    fprintf(stderr, " %02x", input.bytes[b]);
+                }
+                fprintf(stderr, "\n");
+            }
+        }
+        chat_sist_os__user_option__free_unpacked(option, NULL);
+    }
+    printf("fuzz: %ld casos, %ld por la vía rápida, %ld aceptados por protobuf-c, %ld diferencias\n",
+           cases, fast, generic, mismatches);
+    return mismatches == 0;
+}
+
+int main(int argc, char *argv[]) {
+    long cases = argc > 1 ? atol(argv[1]) : 1000000;
+    int decodes = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    int equivalent = fuzz(cases);
+
+    // A chat message of about 100 bytes, the request worth speeding up
+    ChatSistOS__Message message = CHAT_SIST_OS__MESSAGE__INIT;
+    message.message_content = "hola a todos, ¿alguien sabe a qué hora empieza la reunión de mañana?";
+    message.message_sender = "usuario_de_prueba";
+    ChatSistOS__UserOption option = CHAT_SIST_OS__USER_OPTION__INIT;
+    option.op = 4;
+    option.message = &message;
+    size_t len = chat_sist_os__user_option__get_packed_size(&option);
+    uint8_t *data = malloc(len);
+    chat_sist_os__user_option__pack(&option, data);
+
+    // Both as the server does it: into the request arena, reset after each
+    Arena arena = { 0 };
+    size_t sink = 0;
+    double start = now_seconds();
+    for (int i = 0; i < decodes; i++) {
+        ChatSistOS__UserOption *decoded = chat_sist_os__user_option__unpack(arena_allocator(&arena), len, data);
+        sink += strlen(decoded->message->message_content);
+        arena_reset(&arena);
+    }
+    double generic_time = now_seconds() - start;
+
+    start = now_seconds();
+    for (int i = 0; i < decodes; i++) {
+        RequestView view;
+        request_view_decode(data, len, &view);
+        sink += view.message.message_content.len;
+    }
+    double view_time = now_seconds() - start;
+
+    // Plus the copy into the arena that gives the handlers C strings, as
+    // process_request does
+    start = now_seconds();
+    for (int i = 0; i < decodes; i++) {
+        RequestView view;
+        ChatSistOS__UserOption fast_option;
+        request_view_decode(data, len, &view);
+        ChatSistOS__UserOption *decoded = request_view_option(&view, &arena, &fast_option);
+        sink += strlen(decoded->message->message_content);
+        arena_reset(&arena);
+    }
+    double copy_time = now_seconds() - start;
+    arena_destroy(&arena);
+
+    printf("%d decodificaciones de %zu bytes (%zu)\n", decodes, len, sink);
+    printf("protobuf-c:         %.1f ns/petición\n", generic_time * 1e9 / decodes);
+    printf("vistas:             %.1f ns/petición (%.0f%%)\n", view_time * 1e9 / decodes, 100 * view_time / generic_time);
+    printf("vistas + copias:    %.1f ns/petición (%.0f%%)\n", copy_time * 1e9 / decodes, 100 * copy_time / generic_time);
+
+    free(data);
+    return equivalent ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+// Microbenchmark: hash-indexed Registry vs. the ConnectedUser linked list it
+// replaced. Build from the repository root with:
+//   gcc -O2 -I. bench/registry_bench.c registry.c -lpthread -o registry_bench
+// Usage: ./registry_bench [usuarios] [busquedas]
+#define _POSIX_C_SOURCE 200809L
+#include "registry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The list as server.c kept it before the registry
+typedef struct ListUser {
+    char user_name[USER_NAME_MAX + 1];
+    int client_socket;
+    struct ListUser *next;
+} ListUser;
+
+static ListUser *list_head = NULL;
+
+static void list_add(const char *name, int client_socket) {
+    ListUser *node = (ListUser *)malloc(sizeof(ListUser));
+    snprintf(node->user_name, sizeof(node->user_name), "%s", name);
+    node->client_socket = client_socket;
+    node->next = list_head;
+    list_head = node;
+}
+
+static ListUser *list_find(const char *name) {
+    for (ListUser *node = list_head; node != NULL; node = node->next) {
+        if (strcmp(node->user_name, name) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void list_remove(int client_socket) {
+    ListUser *previous = NULL;
+    for (ListUser *node = list_head; node != NULL; previous = node, node = node->next) {
+        if (node->client_socket == client_socket) {
+            if (previous == NULL) {
+                list_head = node->next;
+            } else {
+                previous->next = node->next;
+            }
+            free(node);
+            return;
+        }
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, double list_time, double registry_time, size_t ops) {
+    printf("%-22s lista %10.1f ns/op   registro %8.1f ns/op   (x%.0f)\n", what,
+           list_time * 1e9 / ops, registry_time * 1e9 / ops, list_time / registry_time);
+}
+
+int main(int argc, char *argv[]) {
+    size_t users = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+    char name[USER_NAME_MAX + 1];
+    Registry registry;
+    UserHandle *handles = (UserHandle *)calloc(users, sizeof(UserHandle));
+    size_t found = 0;
+
+    if (handles == NULL || !registry_init(&registry)) {
+        perror("Error al inicializar el registro");
+        return 1;
+    }
+    srand(42);
+
+    double start = now_seconds();
+    for (size_t i = 0; i < users; i++) {
+        snprintf(name, sizeof(name), "usuario-%zu", i);
+        list_add(name, (int)i);
+    }
+    double list_time = now_seconds() - start;
+    start = now_seconds();
+    for (size_t i = 0; i < users; i++) {
+        snprintf(name, sizeof(name), "usuario-%zu", i);
+        registry_add(&registry, name, 1, NULL, (int)i, NULL, &handles[i]);
+    }
+    report("alta", list_time, now_seconds() - start, users);
+
+    start = now_seconds();
+    for (size_t i = 0; i < lookups; i++) {
+        snprintf(name, sizeof(name), "usuario-%zu", (size_t)rand() % users);
+        found += list_find(name) != NULL;
+    }
+    list_time = now_seconds() - start;
+    start = now_seconds();
+    for (size_t i = 0; i < lookups; i++) {
+        snprintf(name, sizeof(name), "usuario-%zu", (size_t)rand() % users);
+        found += registry_find_by_name(&registry, name, NULL, NULL);
+    }
+    report("busqueda por nombre", list_time, now_seconds() - start, lookups);
+
+    // Disconnect and reconnect a random user, as a churning server does
+    start = now_seconds();
+    for (size_t i = 0; i < lookups; i++) {
+        size_t victim = (size_t)rand() % users;
+        snprintf(name, sizeof(name), "usuario-%zu", victim);
+        list_remove((int)victim);
+        list_add(name, (int)victim);
+    }
+    list_time = now_seconds() - start;
+    start = now_seconds();
+    for (size_t i = 0; i < lookups; i++) {
+        size_t victim = (size_t)rand() % users;
+        snprintf(name, sizeof(name), "usuario-%zu", victim);
+        registry_find_by_socket(&registry, (int)victim, NULL, NULL);
+        registry_remove(&registry, handles[victim]);
+        registry_add(&registry, name, 1, NULL, (int)victim, NULL, &handles[victim]);
+    }
+    report("baja y alta", list_time, now_seconds() - start, lookups);
+
+    printf("usuarios: %zu, encontrados: %zu de %zu\n", registry_count(&registry), found, 2 * lookups);
+    registry_destroy(&registry);
+    free(handles);
+
+    return 0;
+}
@@ -367,7 +367,97 @@ void   chat_sist_os__message__free_unpacked
   assert(message->base.descriptor == &chat_sist_os__message__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
-static const ProtobufCFieldDescriptor chat_sist_os__user_list__field_descriptors[2] =
+void   chat_sist_os__room__init
+                     (ChatSistOS__Room         *message)
+{
+  static const ChatSistOS__Room init_value = CHAT_SIST_OS__ROOM__INIT;
+  *message = init_value;
+}
+size_t chat_sist_os__room__get_packed_size
+                     (const ChatSistOS__Room *message)
+{
+  assert(message->base.descriptor == &chat_sist_os__room__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t chat_sist_os__room__pack
+                     (const ChatSistOS__Room *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &chat_sist_os__room__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t chat_sist_os__room__pack_to_buffer
+                     (const ChatSistOS__Room *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &chat_sist_os__room__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+ChatSistOS__Room *
+       chat_sist_os__room__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (ChatSistOS__Room *)
+     protobuf_c_message_unpack (&chat_sist_os__room__descriptor,
+                                allocator, len, data);
+}
+void   chat_sist_os__room__free_unpacked
+                     (ChatSistOS__Room *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &chat_sist_os__room__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
+void   chat_sist_os__history_query__init
+                     (ChatSistOS__HistoryQuery         *message)
+{
+  static const ChatSistOS__HistoryQuery init_value = CHAT_SIST_OS__HISTORY_QUERY__INIT;
+  *message = init_value;
+}
+size_t chat_sist_os__history_query__get_packed_size
+                     (const ChatSistOS__HistoryQuery *message)
+{
+  assert(message->base.descriptor == &chat_sist_os__history_query__descriptor);
+  return protobuf_c_message_get_packed_size ((const ProtobufCMessage*)(message));
+}
+size_t chat_sist_os__history_query__pack
+                     (const ChatSistOS__HistoryQuery *message,
+                      uint8_t       *out)
+{
+  assert(message->base.descriptor == &chat_sist_os__history_query__descriptor);
+  return protobuf_c_message_pack ((const ProtobufCMessage*)message, out);
+}
+size_t chat_sist_os__history_query__pack_to_buffer
+                     (const ChatSistOS__HistoryQuery *message,
+                      ProtobufCBuffer *buffer)
+{
+  assert(message->base.descriptor == &chat_sist_os__history_query__descriptor);
+  return protobuf_c_message_pack_to_buffer ((const ProtobufCMessage*)message, buffer);
+}
+ChatSistOS__HistoryQuery *
+       chat_sist_os__history_query__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data)
+{
+  return (ChatSistOS__HistoryQuery *)
+     protobuf_c_message_unpack (&chat_sist_os__history_query__descriptor,
+                                allocator, len, data);
+}
+void   chat_sist_os__history_query__free_unpacked
+                     (ChatSistOS__HistoryQuery *message,
+                      ProtobufCAllocator *allocator)
+{
+  if(!message)
+    return;
+  assert(message->base.descriptor == &chat_sist_os__history_query__descriptor);
+  protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
+}
+static const ProtobufCFieldDescriptor chat_sist_os__user_list__field_descriptors[5] =
 {
   {
     "list",
@@ -393,15 +483,54 @@ static const ProtobufCFieldDescriptor chat_sist_os__user_list__field_descriptors
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "cursor",
+    3,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_STRING,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__UserList, cursor),
+    NULL,
+    &protobuf_c_empty_string,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "page_size",
+    4,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__UserList, page_size),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "subscribe",
+    5,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__UserList, subscribe),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned chat_sist_os__user_list__field_indices_by_name[] = {
+  2,   /* field[2] = cursor */
   0,   /* field[0] = list */
+  3,   /* field[3] = page_size */
+  4,   /* field[4] = subscribe */
   1,   /* field[1] = user_name */
 };
 static const ProtobufCIntRange chat_sist_os__user_list__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 2 }
+  { 0, 5 }
 };
 const ProtobufCMessageDescriptor chat_sist_os__user_list__descriptor =
 {
@@ -411,14 +540,14 @@ const ProtobufCMessageDescriptor chat_sist_os__user_list__descriptor =
   "ChatSistOS__UserList",
   "chat_sistOS",
   sizeof(ChatSistOS__UserList),
-  2,
+  5,
   chat_sist_os__user_list__field_descriptors,
   chat_sist_os__user_list__field_indices_by_name,
   1,  chat_sist_os__user_list__number_ranges,
   (ProtobufCMessageInit) chat_sist_os__user_list__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor chat_sist_os__users_online__field_descriptors[1] =
+static const ProtobufCFieldDescriptor chat_sist_os__users_online__field_descriptors[3] =
 {
   {
     "users",
@@ -432,14 +561,40 @@ static const ProtobufCFieldDescriptor chat_sist_os__users_online__field_descript
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "next_cursor",
+    2,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_STRING,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__UsersOnline, next_cursor),
+    NULL,
+    &protobuf_c_empty_string,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "version",
+    3,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT64,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__UsersOnline, version),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned chat_sist_os__users_online__field_indices_by_name[] = {
+  1,   /* field[1] = next_cursor */
   0,   /* field[0] = users */
+  2,   /* field[2] = version */
 };
 static const ProtobufCIntRange chat_sist_os__users_online__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 1 }
+  { 0, 3 }
 };
 const ProtobufCMessageDescriptor chat_sist_os__users_online__descriptor =
 {
@@ -449,14 +604,14 @@ const ProtobufCMessageDescriptor chat_sist_os__users_online__descriptor =
   "ChatSistOS__UsersOnline",
   "chat_sistOS",
   sizeof(ChatSistOS__UsersOnline),
-  1,
+  3,
   chat_sist_os__users_online__field_descriptors,
   chat_sist_os__users_online__field_indices_by_name,
   1,  chat_sist_os__users_online__number_ranges,
   (ProtobufCMessageInit) chat_sist_os__users_online__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor chat_sist_os__user_option__field_descriptors[5] =
+static const ProtobufCFieldDescriptor chat_sist_os__user_option__field_descriptors[7] =
 {
   {
     "op",
@@ -518,18 +673,44 @@ static const ProtobufCFieldDescriptor chat_sist_os__user_option__field_descripto
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "room",
+    6,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__UserOption, room),
+    &chat_sist_os__room__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "history",
+    7,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_MESSAGE,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__UserOption, history),
+    &chat_sist_os__history_query__descriptor,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned chat_sist_os__user_option__field_indices_by_name[] = {
   1,   /* field[1] = createUser */
+  6,   /* field[6] = history */
   4,   /* field[4] = message */
   0,   /* field[0] = op */
+  5,   /* field[5] = room */
   3,   /* field[3] = status */
   2,   /* field[2] = userList */
 };
 static const ProtobufCIntRange chat_sist_os__user_option__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 5 }
+  { 0, 7 }
 };
 const ProtobufCMessageDescriptor chat_sist_os__user_option__descriptor =
 {
@@ -539,14 +720,14 @@ const ProtobufCMessageDescriptor chat_sist_os__user_option__descriptor =
   "ChatSistOS__UserOption",
   "chat_sistOS",
   sizeof(ChatSistOS__UserOption),
-  5,
+  7,
   chat_sist_os__user_option__field_descriptors,
   chat_sist_os__user_option__field_indices_by_name,
   1,  chat_sist_os__user_option__number_ranges,
   (ProtobufCMessageInit) chat_sist_os__user_option__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor chat_sist_os__answer__field_descriptors[7] =
+static const ProtobufCFieldDescriptor chat_sist_os__answer__field_descriptors[8] =
 {
   {
     "op",
@@ -632,8 +813,21 @@ static const ProtobufCFieldDescriptor chat_sist_os__answer__field_descriptors[7]
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "history_cursor",
+    8,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT64,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__Answer, history_cursor),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned chat_sist_os__answer__field_indices_by_name[] = {
+  7,   /* field[7] = history_cursor */
   4,   /* field[4] = message */
   0,   /* field[0] = op */
   2,   /* field[2] = response_message */
@@ -645,7 +839,7 @@ static const unsigned chat_sist_os__answer__field_indices_by_name[] = {
 static const ProtobufCIntRange chat_sist_os__answer__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 7 }
+  { 0, 8 }
 };
 const ProtobufCMessageDescriptor chat_sist_os__answer__descriptor =
 {
@@ -655,7 +849,7 @@ const ProtobufCMessageDescriptor chat_sist_os__answer__descriptor =
   "ChatSistOS__Answer",
   "chat_sistOS",
   sizeof(ChatSistOS__Answer),
-  7,
+  8,
   chat_sist_os__answer__field_descriptors,
   chat_sist_os__answer__field_indices_by_name,
   1,  chat_sist_os__answer__number_ranges,
@@ -905,3 +1099,131 @@ const ProtobufCMessageDescriptor chat_sist_os__message__descriptor =
   (ProtobufCMessageInit) chat_sist_os__message__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
+static const ProtobufCFieldDescriptor chat_sist_os__room__field_descriptors[2] =
+{
+  {
+    "room_name",
+    1,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_STRING,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__Room, room_name),
+    NULL,
+    &protobuf_c_empty_string,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "join",
+    2,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__Room, join),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned chat_sist_os__room__field_indices_by_name[] = {
+  1,   /* field[1] = join */
+  0,   /* field[0] = room_name */
+};
+static const ProtobufCIntRange chat_sist_os__room__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 2 }
+};
+const ProtobufCMessageDescriptor chat_sist_os__room__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "chat_sistOS.Room",
+  "Room",
+  "ChatSistOS__Room",
+  "chat_sistOS",
+  sizeof(ChatSistOS__Room),
+  2,
+  chat_sist_os__room__field_descriptors,
+  chat_sist_os__room__field_indices_by_name,
+  1,  chat_sist_os__room__number_ranges,
+  (ProtobufCMessageInit) chat_sist_os__room__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
+static const ProtobufCFieldDescriptor chat_sist_os__history_query__field_descriptors[4] =
+{
+  {
+    "room_name",
+    1,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_STRING,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__HistoryQuery, room_name),
+    NULL,
+    &protobuf_c_empty_string,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "peer",
+    2,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_STRING,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__HistoryQuery, peer),
+    NULL,
+    &protobuf_c_empty_string,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "since",
+    3,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT64,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__HistoryQuery, since),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "limit",
+    4,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(ChatSistOS__HistoryQuery, limit),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+};
+static const unsigned chat_sist_os__history_query__field_indices_by_name[] = {
+  3,   /* field[3] = limit */
+  1,   /* field[1] = peer */
+  0,   /* field[0] = room_name */
+  2,   /* field[2] = since */
+};
+static const ProtobufCIntRange chat_sist_os__history_query__number_ranges[1 + 1] =
+{
+  { 1, 0 },
+  { 0, 4 }
+};
+const ProtobufCMessageDescriptor chat_sist_os__history_query__descriptor =
+{
+  PROTOBUF_C__MESSAGE_DESCRIPTOR_MAGIC,
+  "chat_sistOS.HistoryQuery",
+  "HistoryQuery",
+  "ChatSistOS__HistoryQuery",
+  "chat_sistOS",
+  sizeof(ChatSistOS__HistoryQuery),
+  4,
+  chat_sist_os__history_query__field_descriptors,
+  chat_sist_os__history_query__field_indices_by_name,
+  1,  chat_sist_os__history_query__number_ranges,
+  (ProtobufCMessageInit) chat_sist_os__history_query__init,
+  NULL,NULL,NULL    /* reserved[123] */
+};
@@ -23,6 +23,8 @@ typedef struct _ChatSistOS__User ChatSistOS__User;
 typedef struct _ChatSistOS__NewUser ChatSistOS__NewUser;
 typedef struct _ChatSistOS__Status ChatSistOS__Status;
 typedef struct _ChatSistOS__Message ChatSistOS__Message;
+typedef struct _ChatSistOS__Room ChatSistOS__Room;
+typedef struct _ChatSistOS__HistoryQuery ChatSistOS__HistoryQuery;
 
 
 /* --- enums --- */
@@ -42,10 +44,22 @@ struct  _ChatSistOS__UserList
    * se manda vacio si es para todos, nombre de usuario si es especifico
    */
   char *user_name;
+  /*
+   * vacio = desde el principio, si no el next_cursor de la pagina anterior
+   */
+  char *cursor;
+  /*
+   * usuarios por pagina, 0 = todos
+   */
+  uint32_t page_size;
+  /*
+   * verdadero = despues de la lista, recibir solo los cambios (op 5)
+   */
+  protobuf_c_boolean subscribe;
 };
 #define CHAT_SIST_OS__USER_LIST__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&chat_sist_os__user_list__descriptor) \
-    , 0, (char *)protobuf_c_empty_string }
+    , 0, (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, 0, 0 }
 
 
 struct  _ChatSistOS__UsersOnline
@@ -56,10 +70,18 @@ struct  _ChatSistOS__UsersOnline
    */
   size_t n_users;
   ChatSistOS__User **users;
+  /*
+   * vacio si es la ultima pagina
+   */
+  char *next_cursor;
+  /*
+   * cambia cada vez que alguien entra, sale o cambia de estado
+   */
+  uint64_t version;
 };
 #define CHAT_SIST_OS__USERS_ONLINE__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&chat_sist_os__users_online__descriptor) \
-    , 0,NULL }
+    , 0,NULL, (char *)protobuf_c_empty_string, 0 }
 
 
 struct  _ChatSistOS__UserOption
@@ -67,6 +89,7 @@ struct  _ChatSistOS__UserOption
   ProtobufCMessage base;
   /*
    * opcion a realizar
+   * 6 = respuesta a un latido del servidor, no lleva contestacion
    */
   int32_t op;
   /*
@@ -85,10 +108,18 @@ struct  _ChatSistOS__UserOption
    * enviar mensaje
    */
   ChatSistOS__Message *message;
+  /*
+   * entrar o salir de una sala (op 7)
+   */
+  ChatSistOS__Room *room;
+  /*
+   * pedir mensajes pasados (op 8)
+   */
+  ChatSistOS__HistoryQuery *history;
 };
 #define CHAT_SIST_OS__USER_OPTION__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&chat_sist_os__user_option__descriptor) \
-    , 0, NULL, NULL, NULL, NULL }
+    , 0, NULL, NULL, NULL, NULL, NULL, NULL }
 
 
 struct  _ChatSistOS__Answer
@@ -96,6 +127,8 @@ struct  _ChatSistOS__Answer
   ProtobufCMessage base;
   /*
    * opcion recibida
+   * 6 = latido: el cliente lleva un rato sin enviar nada y debe responder
+   * con op 6 o sera desconectado
    */
   int32_t op;
   /*
@@ -122,10 +155,15 @@ struct  _ChatSistOS__Answer
    * Status del usuario
    */
   ChatSistOS__Status *status;
+  /*
+   * op 8: secuencia del ultimo mensaje revisado; se manda como since en
+   * la siguiente consulta para seguir desde ahi
+   */
+  uint64_t history_cursor;
 };
 #define CHAT_SIST_OS__ANSWER__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&chat_sist_os__answer__descriptor) \
-    , 0, 0, (char *)protobuf_c_empty_string, NULL, NULL, NULL, NULL }
+    , 0, 0, (char *)protobuf_c_empty_string, NULL, NULL, NULL, NULL, 0 }
 
 
 struct  _ChatSistOS__User
@@ -184,11 +222,12 @@ struct  _ChatSistOS__Message
 {
   ProtobufCMessage base;
   /*
-   * false = se manda a todos, true = mensaje directo
+   * false = se manda a todos o a una sala, true = mensaje directo
    */
   protobuf_c_boolean message_private;
   /*
-   * Vacio si es para todos, nombre de usuario si es directo
+   * Vacio si es para todos, nombre de usuario si es directo, nombre de la
+   * sala si no es directo y va a una sala
    */
   char *message_destination;
   /*
@@ -205,6 +244,50 @@ struct  _ChatSistOS__Message
     , 0, (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string }
 
 
+struct  _ChatSistOS__Room
+{
+  ProtobufCMessage base;
+  /*
+   * Nombre de la sala; se crea al entrar el primero y desaparece al
+   * salir el ultimo
+   */
+  char *room_name;
+  /*
+   * verdadero = entrar, falso = salir
+   */
+  protobuf_c_boolean join;
+};
+#define CHAT_SIST_OS__ROOM__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&chat_sist_os__room__descriptor) \
+    , (char *)protobuf_c_empty_string, 0 }
+
+
+struct  _ChatSistOS__HistoryQuery
+{
+  ProtobufCMessage base;
+  /*
+   * Vacio y sin peer = chat general; si no, la sala (hay que estar en ella)
+   */
+  char *room_name;
+  /*
+   * Usuario con el que se tiene la conversacion directa
+   */
+  char *peer;
+  /*
+   * 0 = los ultimos 'limit' mensajes; si no, los posteriores a esta
+   * secuencia (el history_cursor de la respuesta anterior)
+   */
+  uint64_t since;
+  /*
+   * Mensajes como maximo, 0 = los del servidor por defecto
+   */
+  uint32_t limit;
+};
+#define CHAT_SIST_OS__HISTORY_QUERY__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&chat_sist_os__history_query__descriptor) \
+    , (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, 0, 0 }
+
+
 /* ChatSistOS__UserList methods */
 void   chat_sist_os__user_list__init
                      (ChatSistOS__UserList         *message);
@@ -357,6 +440,44 @@ ChatSistOS__Message *
 void   chat_sist_os__message__free_unpacked
                      (ChatSistOS__Message *message,
                       ProtobufCAllocator *allocator);
+/* ChatSistOS__Room methods */
+void   chat_sist_os__room__init
+                     (ChatSistOS__Room         *message);
+size_t chat_sist_os__room__get_packed_size
+                     (const ChatSistOS__Room   *message);
+size_t chat_sist_os__room__pack
+                     (const ChatSistOS__Room   *message,
+                      uint8_t             *out);
+size_t chat_sist_os__room__pack_to_buffer
+                     (const ChatSistOS__Room   *message,
+                      ProtobufCBuffer     *buffer);
+ChatSistOS__Room *
+       chat_sist_os__room__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   chat_sist_os__room__free_unpacked
+                     (ChatSistOS__Room *message,
+                      ProtobufCAllocator *allocator);
+/* ChatSistOS__HistoryQuery methods */
+void   chat_sist_os__history_query__init
+                     (ChatSistOS__HistoryQuery         *message);
+size_t chat_sist_os__history_query__get_packed_size
+                     (const ChatSistOS__HistoryQuery   *message);
+size_t chat_sist_os__history_query__pack
+                     (const ChatSistOS__HistoryQuery   *message,
+                      uint8_t             *out);
+size_t chat_sist_os__history_query__pack_to_buffer
+                     (const ChatSistOS__HistoryQuery   *message,
+                      ProtobufCBuffer     *buffer);
+ChatSistOS__HistoryQuery *
+       chat_sist_os__history_query__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   chat_sist_os__history_query__free_unpacked
+                     (ChatSistOS__HistoryQuery *message,
+                      ProtobufCAllocator *allocator);
 /* --- per-message closures --- */
 
 typedef void (*ChatSistOS__UserList_Closure)
@@ -383,6 +504,12 @@ typedef void (*ChatSistOS__Status_Closure)
 typedef void (*ChatSistOS__Message_Closure)
                  (const ChatSistOS__Message *message,
                   void *closure_data);
+typedef void (*ChatSistOS__Room_Closure)
+                 (const ChatSistOS__Room *message,
+                  void *closure_data);
+typedef void (*ChatSistOS__HistoryQuery_Closure)
+                 (const ChatSistOS__HistoryQuery *message,
+                  void *closure_data);
 
 /* --- services --- */
 
@@ -397,6 +524,8 @@ extern const ProtobufCMessageDescriptor chat_sist_os__user__descriptor;
 extern const ProtobufCMessageDescriptor chat_sist_os__new_user__descriptor;
 extern const ProtobufCMessageDescriptor chat_sist_os__status__descriptor;
 extern const ProtobufCMessageDescriptor chat_sist_os__message__descriptor;
+extern const ProtobufCMessageDescriptor chat_sist_os__room__descriptor;
+extern const ProtobufCMessageDescriptor chat_sist_os__history_query__descriptor;
 
 PROTOBUF_C__END_DECLS
 
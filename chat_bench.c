@@ -0,0 +1,540 @@
+// Load generator for the chat server. Opens N clients against a server on
+// loopback, registers them, then keeps every client busy with a weighted
+// mix of requests for a fixed time and reports throughput plus latency
+// percentiles per operation, and the end-to-end delivery latency of the
+// messages clients receive from each other. Build from the repository
+// root with:
+//   gcc -O2 chat_bench.c chat.pb-c.c framing.c histogram.c -lprotobuf-c -lpthread -o chat_bench
+// Usage: ./chat_bench [-c clientes] [-t hilos] [-d segundos] [-p profundidad]
+//                     [-s bytes] [-m dm=65,broadcast=10,list=25,status=0] [host] <puerto>
+#define _GNU_SOURCE
+#include "chat.pb-c.h"
+#include "framing.h"
+#include "histogram.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_DEPTH 64
+#define BENCH_MAX_EVENTS 256
+#define BENCH_DRAIN_SECONDS 2
+
+typedef enum BenchOp {
+    BENCH_DM,
+    BENCH_BROADCAST,
+    BENCH_LIST,
+    BENCH_STATUS,
+    BENCH_REGISTER,
+    BENCH_OPS
+} BenchOp;
+
+static const char *bench_op_names[BENCH_OPS] = { "dm", "broadcast", "list", "status", "register" };
+
+typedef struct BenchConfig {
+    int clients;
+    int threads;
+    int seconds;
+    int depth;
+    size_t payload;
+    unsigned weights[BENCH_OPS];
+    unsigned total_weight;
+    struct sockaddr_in server_addr;
+} BenchConfig;
+
+struct BenchThread;
+
+typedef struct BenchClient {
+    int fd;
+    int index;
+    char name[32];
+    struct BenchThread *thread;
+    FrameBuffer in_frames;
+    // Requests not fully written yet
+    uint8_t *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_capacity;
+    // Requests waiting for their Answer, oldest first; the server answers
+    // each connection in order
+    BenchOp pending_op[BENCH_MAX_DEPTH];
+    uint64_t pending_sent[BENCH_MAX_DEPTH];
+    int pending_head;
+    int pending_count;
+    bool registered;
+} BenchClient;
+
+typedef struct BenchThread {
+    pthread_t thread_id;
+    int epoll_fd;
+    BenchClient *clients;
+    int count;
+    int registered;
+    uint64_t rng;
+    Histogram latency[BENCH_OPS];
+    Histogram delivery;
+    uint64_t completed[BENCH_OPS];
+    uint64_t errors;
+} BenchThread;
+
+static BenchConfig config;
+static pthread_barrier_t start_barrier;
+static atomic_bool running;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t bench_random(BenchThread *thread) {
+    // xorshift64
+    thread->rng ^= thread->rng << 13;
+    thread->rng ^= thread->rng >> 7;
+    thread->rng ^= thread->rng << 17;
+    return thread->rng;
+}
+
+static void bench_queue(BenchClient *client, ChatSistOS__UserOption *option) {
+    size_t len = chat_sist_os__user_option__get_packed_size(option);
+    size_t needed = client->out_len + FRAME_HEADER_SIZE + len;
+    if (needed > client->out_capacity) {
+        size_t capacity = client->out_capacity > 0 ? client->out_capacity : 4096;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        uint8_t *grown = (uint8_t *)realloc(client->out, capacity);
+        if (grown == NULL) {
+            perror("Error al asignar memoria para las peticiones");
+            exit(EXIT_FAILURE);
+        }
+        client->out = grown;
+        client->out_capacity = capacity;
+    }
+
+    frame_write_header(client->out + client->out_len, len);
+    chat_sist_os__user_option__pack(option, client->out + client->out_len + FRAME_HEADER_SIZE);
+    client->out_len = needed;
+}
+
+static bool bench_flush(BenchClient *client) {
+    while (client->out_sent < client->out_len) {
+        ssize_t sent = send(client->fd, client->out + client->out_sent, client->out_len - client->out_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN: the rest goes on the next EPOLLOUT edge
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client->out_sent += (size_t)sent;
+    }
+    client->out_len = 0;
+    client->out_sent = 0;
+
+    return true;
+}
+
+static void bench_push_pending(BenchClient *client, BenchOp op) {
+    int slot = (client->pending_head + client->pending_count) % BENCH_MAX_DEPTH;
+    client->pending_op[slot] = op;
+    client->pending_sent[slot] = now_ns();
+    client->pending_count++;
+}
+
+static void bench_send_register(BenchClient *client) {
+    ChatSistOS__NewUser new_user = CHAT_SIST_OS__NEW_USER__INIT;
+    new_user.username = client->name;
+    new_user.ip = "127.0.0.1";
+    ChatSistOS__UserOption option = CHAT_SIST_OS__USER_OPTION__INIT;
+    option.op = 1;
+    option.createuser = &new_user;
+
+    bench_queue(client, &option);
+    bench_push_pending(client, BENCH_REGISTER);
+}
+
+static BenchOp bench_pick_op(BenchThread *thread) {
+    unsigned roll = (unsigned)(bench_random(thread) % config.total_weight);
+    for (int op = 0; op < BENCH_REGISTER; op++) {
+        if (roll < config.weights[op]) {
+            return (BenchOp)op;
+        }
+        roll -= config.weights[op];
+    }
+    return BENCH_DM;
+}
+
+// Sends one request of the configured mix. Message contents start with the
+// send time so receivers can measure delivery latency.
+static void bench_send_next(BenchClient *client) {
+    BenchThread *thread = client->thread;
+    char content[config.payload + 32];
+    char destination[32];
+    ChatSistOS__UserOption option = CHAT_SIST_OS__USER_OPTION__INIT;
+    ChatSistOS__Message message = CHAT_SIST_OS__MESSAGE__INIT;
+    ChatSistOS__UserList user_list = CHAT_SIST_OS__USER_LIST__INIT;
+    ChatSistOS__Status status = CHAT_SIST_OS__STATUS__INIT;
+    BenchOp op = bench_pick_op(thread);
+
+    switch (op) {
+    case BENCH_DM:
+    case BENCH_BROADCAST: {
+        int written = snprintf(content, sizeof(content), "t=%" PRIu64 " ", now_ns());
+        memset(content + written, 'x', config.payload > (size_t)written ? config.payload - (size_t)written : 0);
+        content[config.payload > (size_t)written ? config.payload : (size_t)written] = '\0';
+        message.message_content = content;
+        message.message_sender = client->name;
+        if (op == BENCH_DM) {
+            int target = (int)(bench_random(thread) % (uint64_t)(config.clients - 1));
+            if (target >= client->index) {
+                target++;
+            }
+            snprintf(destination, sizeof(destination), "bench_%d", target);
+            message.message_private = true;
+            message.message_destination = destination;
+        }
+        option.op = 4;
+        option.message = &message;
+        break;
+    }
+    case BENCH_LIST:
+        user_list.list = true;
+        option.op = 2;
+        option.userlist = &user_list;
+        break;
+    default:
+        status.user_name = client->name;
+        status.user_state = 1 + (int32_t)(bench_random(thread) % 2);
+        option.op = 3;
+        option.status = &status;
+        break;
+    }
+
+    bench_queue(client, &option);
+    bench_push_pending(client, op);
+}
+
+static void bench_fill(BenchClient *client) {
+    while (atomic_load_explicit(&running, memory_order_relaxed) && client->pending_count < config.depth) {
+        bench_send_next(client);
+    }
+}
+
+static void bench_handle_answer(BenchClient *client, const uint8_t *data, size_t len) {
+    BenchThread *thread = client->thread;
+    uint64_t now = now_ns();
+    ChatSistOS__Answer *answer = chat_sist_os__answer__unpack(NULL, len, data);
+    if (answer == NULL) {
+        thread->errors++;
+        return;
+    }
+
+    // A message another client sent, as opposed to the reply to a request
+    if (answer->op == 4 && answer->message != NULL && answer->message->message_sender != NULL && answer->message->message_sender[0] != '\0') {
+        uint64_t sent;
+        if (sscanf(answer->message->message_content, "t=%" SCNu64, &sent) == 1 && sent <= now) {
+            histogram_record(&thread->delivery, now - sent);
+        }
+    } else if (answer->op == 6) {
+        // A ping; bench clients never go quiet long enough to be dropped
+    } else if (client->pending_count > 0) {
+        BenchOp op = client->pending_op[client->pending_head];
+        uint64_t sent = client->pending_sent[client->pending_head];
+        client->pending_head = (client->pending_head + 1) % BENCH_MAX_DEPTH;
+        client->pending_count--;
+
+        if (op == BENCH_REGISTER) {
+            client->registered = answer->response_status_code == 200;
+            thread->registered++;
+        }
+        if (answer->response_status_code != 200) {
+            thread->errors++;
+        }
+        histogram_record(&thread->latency[op], now - sent);
+        if (op == BENCH_REGISTER || atomic_load_explicit(&running, memory_order_relaxed)) {
+            thread->completed[op]++;
+        }
+    }
+
+    chat_sist_os__answer__free_unpacked(answer, NULL);
+}
+
+static bool bench_read(BenchClient *client) {
+    while (1) {
+        ssize_t len = frame_buffer_recv(&client->in_frames, client->fd);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (len == 0) {
+            return false;
+        }
+
+        const uint8_t *payload;
+        size_t payload_len;
+        while (frame_buffer_next(&client->in_frames, &payload, &payload_len) > 0) {
+            bench_handle_answer(client, payload, payload_len);
+        }
+    }
+}
+
+// Runs the thread's clients until every registration is answered, or, once
+// the run has started, until it has been stopped and the requests still in
+// flight had time to come back
+static void bench_poll(BenchThread *thread, bool registering) {
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    uint64_t drain_deadline = 0;
+
+    while (1) {
+        if (registering && thread->registered == thread->count) {
+            return;
+        }
+        if (!registering && !atomic_load(&running)) {
+            int in_flight = 0;
+            for (int i = 0; i < thread->count; i++) {
+                in_flight += thread->clients[i].pending_count;
+            }
+            if (drain_deadline == 0) {
+                drain_deadline = now_ns() + BENCH_DRAIN_SECONDS * 1000000000ull;
+            }
+            if (in_flight == 0 || now_ns() > drain_deadline) {
+                return;
+            }
+        }
+
+        int n = epoll_wait(thread->epoll_fd, events, BENCH_MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++) {
+            BenchClient *client = (BenchClient *)events[i].data.ptr;
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) || !bench_read(client)) {
+                fprintf(stderr, "El servidor cerró la conexión de %s\n", client->name);
+                exit(EXIT_FAILURE);
+            }
+            if (!registering) {
+                bench_fill(client);
+            }
+            if (!bench_flush(client)) {
+                perror("Error al enviar la petición");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+static void *bench_thread(void *thread_ptr) {
+    BenchThread *thread = (BenchThread *)thread_ptr;
+
+    for (int i = 0; i < thread->count; i++) {
+        BenchClient *client = &thread->clients[i];
+        client->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (client->fd < 0 || connect(client->fd, (struct sockaddr *)&config.server_addr, sizeof(config.server_addr)) < 0) {
+            perror("Error al conectar con el servidor");
+            exit(EXIT_FAILURE);
+        }
+        int one = 1;
+        setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = client;
+        if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, client->fd, &event) < 0) {
+            perror("Error al registrar el socket en epoll");
+            exit(EXIT_FAILURE);
+        }
+        bench_send_register(client);
+        bench_flush(client);
+    }
+    bench_poll(thread, true);
+
+    // Every client of every thread is registered before anyone sends a DM
+    pthread_barrier_wait(&start_barrier);
+    pthread_barrier_wait(&start_barrier);
+
+    for (int i = 0; i < thread->count; i++) {
+        bench_fill(&thread->clients[i]);
+        bench_flush(&thread->clients[i]);
+    }
+    bench_poll(thread, false);
+
+    return NULL;
+}
+
+static bool parse_mix(const char *mix) {
+    char *copy = strdup(mix);
+    char *save = NULL;
+    memset(config.weights, 0, sizeof(config.weights));
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char *equals = strchr(item, '=');
+        if (equals == NULL) {
+            free(copy);
+            return false;
+        }
+        *equals = '\0';
+        int op;
+        for (op = 0; op < BENCH_REGISTER; op++) {
+            if (strcmp(item, bench_op_names[op]) == 0) {
+                break;
+            }
+        }
+        if (op == BENCH_REGISTER) {
+            free(copy);
+            return false;
+        }
+        config.weights[op] = (unsigned)atoi(equals + 1);
+    }
+    free(copy);
+
+    config.total_weight = 0;
+    for (int op = 0; op < BENCH_REGISTER; op++) {
+        config.total_weight += config.weights[op];
+    }
+    return config.total_weight > 0;
+}
+
+static void print_row(const char *name, const Histogram *histogram, uint64_t completed, double seconds) {
+    if (histogram->total == 0) {
+        printf("%-12s %10" PRIu64 " %11.0f %10s %10s %10s %10s\n", name, completed, completed / seconds, "-", "-", "-", "-");
+        return;
+    }
+    printf("%-12s %10" PRIu64 " %11.0f %10.1f %10.1f %10.1f %10.1f\n", name, completed, completed / seconds,
+           histogram_percentile(histogram, 0.50) / 1e3, histogram_percentile(histogram, 0.99) / 1e3,
+           histogram_percentile(histogram, 0.999) / 1e3, histogram->max / 1e3);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-c clientes] [-t hilos] [-d segundos] [-p profundidad] [-s bytes] "
+                    "[-m dm=65,broadcast=10,list=25,status=0] [host] <puerto>\n", program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    config.clients = 100;
+    config.threads = 4;
+    config.seconds = 10;
+    config.depth = 1;
+    config.payload = 64;
+    const char *mix = "dm=65,broadcast=10,list=25,status=0";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:d:p:s:m:")) != -1) {
+        switch (opt) {
+        case 'c': config.clients = atoi(optarg); break;
+        case 't': config.threads = atoi(optarg); break;
+        case 'd': config.seconds = atoi(optarg); break;
+        case 'p': config.depth = atoi(optarg); break;
+        case 's': config.payload = strtoul(optarg, NULL, 10); break;
+        case 'm': mix = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (argc - optind < 1 || argc - optind > 2 || config.clients < 2 || config.threads < 1 ||
+        config.seconds < 1 || config.depth < 1 || config.depth > BENCH_MAX_DEPTH || !parse_mix(mix)) {
+        usage(argv[0]);
+    }
+    if (config.threads > config.clients) {
+        config.threads = config.clients;
+    }
+
+    config.server_addr.sin_family = AF_INET;
+    config.server_addr.sin_port = htons(atoi(argv[argc - 1]));
+    config.server_addr.sin_addr.s_addr = inet_addr(argc - optind == 2 ? argv[optind] : "127.0.0.1");
+
+    BenchThread *threads = (BenchThread *)calloc((size_t)config.threads, sizeof(BenchThread));
+    BenchClient *clients = (BenchClient *)calloc((size_t)config.clients, sizeof(BenchClient));
+    if (threads == NULL || clients == NULL) {
+        perror("Error al asignar memoria para los clientes");
+        return 1;
+    }
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)config.threads + 1);
+
+    int next_client = 0;
+    for (int t = 0; t < config.threads; t++) {
+        BenchThread *thread = &threads[t];
+        thread->count = config.clients / config.threads + (t < config.clients % config.threads ? 1 : 0);
+        thread->clients = &clients[next_client];
+        thread->rng = 0x9e3779b97f4a7c15ull * (uint64_t)(t + 1);
+        thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        for (int op = 0; op < BENCH_OPS; op++) {
+            histogram_init(&thread->latency[op]);
+        }
+        histogram_init(&thread->delivery);
+        for (int i = 0; i < thread->count; i++, next_client++) {
+            BenchClient *client = &clients[next_client];
+            client->index = next_client;
+            client->thread = thread;
+            snprintf(client->name, sizeof(client->name), "bench_%d", next_client);
+            frame_buffer_init(&client->in_frames);
+        }
+        if (pthread_create(&thread->thread_id, NULL, bench_thread, thread) != 0) {
+            perror("Error al crear el hilo");
+            return 1;
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    for (int i = 0; i < config.clients; i++) {
+        if (!clients[i].registered) {
+            fprintf(stderr, "No se pudo registrar %s (¿usuarios de otra ejecución?)\n", clients[i].name);
+            return 1;
+        }
+    }
+    atomic_store(&running, true);
+    uint64_t start = now_ns();
+    pthread_barrier_wait(&start_barrier);
+    sleep((unsigned)config.seconds);
+    atomic_store(&running, false);
+    double seconds = (now_ns() - start) / 1e9;
+
+    Histogram latency[BENCH_OPS];
+    Histogram delivery;
+    uint64_t completed[BENCH_OPS] = { 0 };
+    uint64_t errors = 0;
+    for (int op = 0; op < BENCH_OPS; op++) {
+        histogram_init(&latency[op]);
+    }
+    histogram_init(&delivery);
+    for (int t = 0; t < config.threads; t++) {
+        pthread_join(threads[t].thread_id, NULL);
+        for (int op = 0; op < BENCH_OPS; op++) {
+            histogram_merge(&latency[op], &threads[t].latency[op]);
+            completed[op] += threads[t].completed[op];
+        }
+        histogram_merge(&delivery, &threads[t].delivery);
+        errors += threads[t].errors;
+    }
+
+    uint64_t total = 0;
+    for (int op = 0; op < BENCH_REGISTER; op++) {
+        total += completed[op];
+    }
+    printf("%d clientes, %d hilos, %.1f s, profundidad %d, %zu bytes, mezcla %s\n",
+           config.clients, config.threads, seconds, config.depth, config.payload, mix);
+    printf("%-12s %10s %11s %10s %10s %10s %10s\n", "op", "total", "ops/s", "p50 us", "p99 us", "p999 us", "max us");
+    for (int op = 0; op < BENCH_OPS; op++) {
+        if (completed[op] > 0) {
+            print_row(bench_op_names[op], &latency[op], completed[op], seconds);
+        }
+    }
+    print_row("entrega", &delivery, delivery.total, seconds);
+    printf("total: %" PRIu64 " peticiones, %.0f ops/s, %" PRIu64 " errores\n", total, total / seconds, errors);
+
+    for (int i = 0; i < config.clients; i++) {
+        close(clients[i].fd);
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "chat.pb-c.h"
+#include "framing.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <pthread.h>
@@ -11,14 +12,20 @@
 
 // Function prototypes
 void *receive_message_thread(void *socket);
+void display_answer(int client_socket, const uint8_t *buf, size_t len);
+void send_heartbeat_reply(int client_socket);
 int display_menu();
-void change_status(int client_socket);
+void change_status(int client_socket, const char *user);
 void send_private_message(int client_socket, const char* user, const char* message_text);
 void broadcast_message(int client_socket, const char* user, const char *message_text);
 void list_connected_users(int client_socket);
 void display_user_info(int client_socket);
 void display_help();
 void create_user(int client_socket,  char* user);
+void send_message(int client_socket, ChatSistOS__Message *message);
+void change_room(int client_socket);
+void send_room_message(int client_socket, const char *user, const char *message_text);
+void request_history(int client_socket);
 
 
 int main(int argc, char *argv[]) {
@@ -79,7 +86,7 @@ int main(int argc, char *argv[]) {
                 break;
             }
             case 3:
-                change_status(client_socket);
+                change_status(client_socket, username);
                 break;
             case 4:
                 list_connected_users(client_socket);
@@ -94,6 +101,20 @@ int main(int argc, char *argv[]) {
                 // Exit the application
                 printf("Saliendo...\n");
                 return 0;
+            case 8:
+                change_room(client_socket);
+                break;
+            case 9: {
+                char message[256];
+                printf("Enter your message: ");
+                fgets(message, sizeof(message), stdin);
+                message[strcspn(message, "\n")] = 0;
+                send_room_message(client_socket, username, message);
+                break;
+            }
+            case 10:
+                request_history(client_socket);
+                break;
             default:
                 printf("Opción inválida. Por favor, intente de nuevo.\n");
         }
@@ -116,6 +137,9 @@ int display_menu() {
     printf("5. Desplegar información de un usuario en particular\n");
     printf("6. Ayuda\n");
     printf("7. Salir\n");
+    printf("8. Entrar o salir de una sala\n");
+    printf("9. Chatear en una sala\n");
+    printf("10. Ver mensajes anteriores\n");
     printf("Ingrese su opción: ");
     scanf("%d", &choice);
     getchar(); // Clear newline character from input buffer
@@ -129,16 +153,7 @@ void broadcast_message(int client_socket, const char* user, const char *message_
     message.message_content = (char *)message_text;
     message.message_private = false;
 
-    // Serialize the message
-    size_t len = chat_sist_os__message__get_packed_size(&message);
-    uint8_t *buf = (uint8_t *)malloc(len);
-    chat_sist_os__message__pack(&message, buf);
-
-    // Send the message to the server
-    send(client_socket, buf, len, 0);
-
-    // Clean up
-    free(buf);
+    send_message(client_socket, &message);
 }
 
 void send_private_message(int client_socket, const char* user, const char *message_text) {
@@ -155,57 +170,241 @@ void send_private_message(int client_socket, const char* user, const char *messa
     message.message_private = true;
     message.message_destination = recipient;
 
+    send_message(client_socket, &message);
+}
+
+void send_room_message(int client_socket, const char *user, const char *message_text) {
+    char room[256];
+    printf("Enter the room name: ");
+    fgets(room, sizeof(room), stdin);
+    room[strcspn(room, "\n")] = 0;
+
+    // A public message with a destination goes to that room only
+    ChatSistOS__Message message = CHAT_SIST_OS__MESSAGE__INIT;
+    message.message_sender = (char *)user;
+    message.message_content = (char *)message_text;
+    message.message_private = false;
+    message.message_destination = room;
+
+    send_message(client_socket, &message);
+}
+
+void change_room(int client_socket) {
+    char room_name[256];
+    char choice[16];
+    printf("Enter the room name: ");
+    if (fgets(room_name, sizeof(room_name), stdin) == NULL) {
+        return;
+    }
+    room_name[strcspn(room_name, "\n")] = 0;
+    printf("Join or leave (1 entrar, 2 salir): ");
+    if (fgets(choice, sizeof(choice), stdin) == NULL) {
+        return;
+    }
+
+    ChatSistOS__Room room = CHAT_SIST_OS__ROOM__INIT;
+    room.room_name = room_name;
+    room.join = atoi(choice) == 1;
 
-    // Serialize the message
-    size_t len = chat_sist_os__message__get_packed_size(&message);
+    ChatSistOS__UserOption user_option = CHAT_SIST_OS__USER_OPTION__INIT;
+    user_option.op = 7;
+    user_option.room = &room;
+
+    size_t packed_size = chat_sist_os__user_option__get_packed_size(&user_option);
+    uint8_t packed[packed_size];
+    chat_sist_os__user_option__pack(&user_option, packed);
+    frame_send(client_socket, packed, packed_size);
+}
+
+// The messages come back as ordinary deliveries, then an answer whose
+// cursor can be given as "desde" to get only what came after them
+void request_history(int client_socket) {
+    char room_name[256];
+    char peer[256];
+    char since[32];
+    printf("Enter the room name (empty for none): ");
+    if (fgets(room_name, sizeof(room_name), stdin) == NULL) {
+        return;
+    }
+    room_name[strcspn(room_name, "\n")] = 0;
+    printf("Enter the username for direct messages (empty for none): ");
+    if (fgets(peer, sizeof(peer), stdin) == NULL) {
+        return;
+    }
+    peer[strcspn(peer, "\n")] = 0;
+    printf("Desde (0 = los últimos): ");
+    if (fgets(since, sizeof(since), stdin) == NULL) {
+        return;
+    }
+
+    ChatSistOS__HistoryQuery query = CHAT_SIST_OS__HISTORY_QUERY__INIT;
+    query.room_name = room_name;
+    query.peer = peer;
+    query.since = strtoull(since, NULL, 10);
+
+    ChatSistOS__UserOption user_option = CHAT_SIST_OS__USER_OPTION__INIT;
+    user_option.op = 8;
+    user_option.history = &query;
+
+    size_t packed_size = chat_sist_os__user_option__get_packed_size(&user_option);
+    uint8_t packed[packed_size];
+    chat_sist_os__user_option__pack(&user_option, packed);
+    frame_send(client_socket, packed, packed_size);
+}
+
+void send_message(int client_socket, ChatSistOS__Message *message) {
+    // Messages travel inside a UserOption like every other request
+    ChatSistOS__UserOption user_option = CHAT_SIST_OS__USER_OPTION__INIT;
+    user_option.op = 4;
+    user_option.message = message;
+
+    // Serialize the request
+    size_t len = chat_sist_os__user_option__get_packed_size(&user_option);
     uint8_t *buf = (uint8_t *)malloc(len);
-    chat_sist_os__message__pack(&message, buf);
+    chat_sist_os__user_option__pack(&user_option, buf);
 
-    // Send the message to the server
-    send(client_socket, buf, len, 0);
+    // Send the request to the server
+    frame_send(client_socket, buf, len);
 
     // Clean up
     free(buf);
 }
 
 
-void change_status(int client_socket) {
-    // Implement the logic for changing user status
+void change_status(int client_socket, const char *user) {
+    char choice[16];
+    printf("Enter the new status (1 en línea, 2 ocupado, 3 desconectado): ");
+    if (fgets(choice, sizeof(choice), stdin) == NULL) {
+        return;
+    }
+
+    ChatSistOS__Status status = CHAT_SIST_OS__STATUS__INIT;
+    status.user_name = (char *)user;
+    status.user_state = atoi(choice);
+
+    ChatSistOS__UserOption user_option = CHAT_SIST_OS__USER_OPTION__INIT;
+    user_option.op = 3;
+    user_option.status = &status;
+
+    size_t packed_size = chat_sist_os__user_option__get_packed_size(&user_option);
+    uint8_t packed[packed_size];
+    chat_sist_os__user_option__pack(&user_option, packed);
+    frame_send(client_socket, packed, packed_size);
 }
 void *receive_message_thread(void *socket) {
     int client_socket = *(int *)socket;
     ssize_t len;
-    uint8_t buf[1024];
+    FrameBuffer frames;
+    frame_buffer_init(&frames);
 
     while (true) {
-        len = recv(client_socket, buf, sizeof(buf), 0);
+        len = frame_buffer_recv(&frames, client_socket);
         if (len <= 0) {
             perror("Error receiving data from server");
             break;
         }
 
-        // Deserialize the received message
-        ChatSistOS__Answer *answer = chat_sist_os__answer__unpack(NULL, len, buf);
-        if (answer == NULL) {
-            perror("Error deserializing the received message");
-            continue;
+        // One recv may carry several answers, or only part of one
+        const uint8_t *payload;
+        size_t payload_len;
+        int status;
+        while ((status = frame_buffer_next(&frames, &payload, &payload_len)) > 0) {
+            display_answer(client_socket, payload, payload_len);
         }
+        if (status < 0) {
+            fprintf(stderr, "Error: frame from server is too large\n");
+            break;
+        }
+    }
 
-        // Display the received message
-        printf("Received message: %s\n", answer->message->message_content);
+    frame_buffer_free(&frames);
+    return NULL;
+}
+
+static void send_user_list_query(int client_socket, ChatSistOS__UserList *query) {
+    ChatSistOS__UserOption user_option = CHAT_SIST_OS__USER_OPTION__INIT;
+    user_option.op = 2;
+    user_option.userlist = query;
 
-        chat_sist_os__answer__free_unpacked(answer, NULL);
+    size_t packed_size = chat_sist_os__user_option__get_packed_size(&user_option);
+    uint8_t packed[packed_size];
+    chat_sist_os__user_option__pack(&user_option, packed);
+    frame_send(client_socket, packed, packed_size);
+}
+
+void display_answer(int client_socket, const uint8_t *buf, size_t len) {
+    // Deserialize the received message
+    ChatSistOS__Answer *answer = chat_sist_os__answer__unpack(NULL, len, buf);
+    if (answer == NULL) {
+        perror("Error deserializing the received message");
+        return;
     }
 
-    return NULL;
+    // Display the received message
+    if (answer->op == 6) {
+        // The server checking we are still here; nothing to show
+        send_heartbeat_reply(client_socket);
+    } else if (answer->op == 8 && answer->response_status_code == 200) {
+        printf("%s (cursor %llu)\n", answer->message != NULL ? answer->message->message_content : "Historial",
+               (unsigned long long)answer->history_cursor);
+    } else if (answer->users_online != NULL) {
+        printf("Usuarios conectados (%zu):\n", answer->users_online->n_users);
+        for (size_t i = 0; i < answer->users_online->n_users; i++) {
+            ChatSistOS__User *user = answer->users_online->users[i];
+            printf("  %s [%d] %s\n", user->user_name, user->user_state, user->user_ip);
+        }
+        // The server cuts long listings into pages; ask for the next one
+        if (answer->users_online->next_cursor[0] != '\0') {
+            ChatSistOS__UserList query = CHAT_SIST_OS__USER_LIST__INIT;
+            query.list = true;
+            query.cursor = answer->users_online->next_cursor;
+            send_user_list_query(client_socket, &query);
+        }
+    } else if (answer->user != NULL) {
+        printf("Usuario %s [%d] %s\n", answer->user->user_name, answer->user->user_state, answer->user->user_ip);
+    } else if (answer->status != NULL) {
+        printf("Usuario %s ahora en estado %d\n", answer->status->user_name, answer->status->user_state);
+    } else if (answer->message != NULL && answer->message->message_sender[0] != '\0') {
+        printf("%s%s: %s\n", answer->message->message_private ? "(privado) " : "", answer->message->message_sender, answer->message->message_content);
+    } else if (answer->message != NULL) {
+        printf("Received message: %s\n", answer->message->message_content);
+    } else {
+        printf("Received answer: %d %s\n", answer->response_status_code, answer->response_message);
+    }
+
+    chat_sist_os__answer__free_unpacked(answer, NULL);
+}
+
+void send_heartbeat_reply(int client_socket) {
+    ChatSistOS__UserOption user_option = CHAT_SIST_OS__USER_OPTION__INIT;
+    user_option.op = 6;
+
+    size_t packed_size = chat_sist_os__user_option__get_packed_size(&user_option);
+    uint8_t packed[packed_size];
+    chat_sist_os__user_option__pack(&user_option, packed);
+    frame_send(client_socket, packed, packed_size);
 }
 
 void list_connected_users(int client_socket) {
-    // Implement the logic for listing connected users
+    ChatSistOS__UserList query = CHAT_SIST_OS__USER_LIST__INIT;
+    query.list = true;
+    // One listing, then only the changes
+    query.subscribe = true;
+    send_user_list_query(client_socket, &query);
 }
 
 void display_user_info(int client_socket) {
-    // Implement the logic for displaying information about a specific user
+    char user_name[256];
+    printf("Enter the username: ");
+    if (fgets(user_name, sizeof(user_name), stdin) == NULL) {
+        return;
+    }
+    user_name[strcspn(user_name, "\n")] = 0;
+
+    ChatSistOS__UserList query = CHAT_SIST_OS__USER_LIST__INIT;
+    query.list = false;
+    query.user_name = user_name;
+    send_user_list_query(client_socket, &query);
 }
 
 void display_help() {
@@ -230,5 +429,5 @@ void create_user(int client_socket, char* username){
     size_t packed_size = chat_sist_os__user_option__get_packed_size(&user_option);
     uint8_t packed[packed_size];
     chat_sist_os__user_option__pack(&user_option, packed);
-    send(client_socket, packed, packed_size, 0);
+    frame_send(client_socket, packed, packed_size);
 }
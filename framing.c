@@ -0,0 +1,172 @@
+#include "framing.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+void frame_buffer_init(FrameBuffer *buffer) {
+    buffer->data = NULL;
+    buffer->capacity = 0;
+    buffer->start = 0;
+    buffer->end = 0;
+}
+
+void frame_buffer_free(FrameBuffer *buffer) {
+    free(buffer->data);
+    frame_buffer_init(buffer);
+}
+
+// Gives the storage back once every received byte has been consumed, so an
+// idle connection does not pin a read buffer
+void frame_buffer_release(FrameBuffer *buffer) {
+    if (buffer->start == buffer->end) {
+        frame_buffer_free(buffer);
+    }
+}
+
+static size_t frame_read_header(const uint8_t *header) {
+    return ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | (size_t)header[3];
+}
+
+// Makes room for at least `wanted` more bytes, preferring to slide the unconsumed
+// bytes to the front over growing the allocation
+static bool frame_buffer_reserve(FrameBuffer *buffer, size_t wanted) {
+    if (buffer->start > 0 && buffer->start == buffer->end) {
+        buffer->start = 0;
+        buffer->end = 0;
+    }
+    if (buffer->capacity - buffer->end >= wanted) {
+        return true;
+    }
+    if (buffer->start > 0) {
+        memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+        buffer->end -= buffer->start;
+        buffer->start = 0;
+        if (buffer->capacity - buffer->end >= wanted) {
+            return true;
+        }
+    }
+
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : FRAME_BUFFER_INITIAL_SIZE;
+    while (capacity - buffer->end < wanted) {
+        capacity *= 2;
+    }
+    uint8_t *grown = (uint8_t *)realloc(buffer->data, capacity);
+    if (grown == NULL) {
+        return false;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+
+    return true;
+}
+
+// Size of the frame being reassembled, or of the next header when no frame
+// is in progress
+static size_t frame_buffer_pending_frame(FrameBuffer *buffer) {
+    size_t available = buffer->end - buffer->start;
+    if (available < FRAME_HEADER_SIZE) {
+        return FRAME_HEADER_SIZE;
+    }
+
+    size_t len = frame_read_header(buffer->data + buffer->start);
+    if (len > FRAME_MAX_PAYLOAD) {
+        return FRAME_HEADER_SIZE;
+    }
+
+    return FRAME_HEADER_SIZE + len;
+}
+
+// One recv into the buffer. Returns what recv returned; -1 with ENOMEM if
+// the buffer could not grow.
+ssize_t frame_buffer_recv(FrameBuffer *buffer, int socket_fd) {
+    size_t available = buffer->end - buffer->start;
+    size_t frame_size = frame_buffer_pending_frame(buffer);
+    size_t wanted = frame_size > available ? frame_size - available : 1;
+    if (wanted < FRAME_BUFFER_INITIAL_SIZE / 2) {
+        wanted = FRAME_BUFFER_INITIAL_SIZE / 2;
+    }
+
+    if (!frame_buffer_reserve(buffer, wanted)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ssize_t len = recv(socket_fd, buffer->data + buffer->end, buffer->capacity - buffer->end, 0);
+    if (len > 0) {
+        buffer->end += (size_t)len;
+    }
+
+    return len;
+}
+
+// Extracts the next complete frame. Returns 1 and points payload into the
+// buffer (valid until the next recv), 0 if more bytes are needed, -1 if the
+// peer announced a frame larger than FRAME_MAX_PAYLOAD.
+int frame_buffer_next(FrameBuffer *buffer, const uint8_t **payload, size_t *len) {
+    size_t available = buffer->end - buffer->start;
+    if (available < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+
+    const uint8_t *header = buffer->data + buffer->start;
+    size_t frame_len = frame_read_header(header);
+    if (frame_len > FRAME_MAX_PAYLOAD) {
+        return -1;
+    }
+    if (available < FRAME_HEADER_SIZE + frame_len) {
+        return 0;
+    }
+
+    *payload = header + FRAME_HEADER_SIZE;
+    *len = frame_len;
+    buffer->start += FRAME_HEADER_SIZE + frame_len;
+
+    return 1;
+}
+
+void frame_write_header(uint8_t *header, size_t len) {
+    header[0] = (uint8_t)(len >> 24);
+    header[1] = (uint8_t)(len >> 16);
+    header[2] = (uint8_t)(len >> 8);
+    header[3] = (uint8_t)len;
+}
+
+// Blocking send of one framed message
+bool frame_send(int socket_fd, const void *payload, size_t len) {
+    uint8_t header[FRAME_HEADER_SIZE];
+    frame_write_header(header, len);
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    while (msg.msg_iovlen > 0) {
+        ssize_t sent = sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov[0].iov_len) {
+            sent -= (ssize_t)msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov[0].iov_base = (uint8_t *)msg.msg_iov[0].iov_base + sent;
+            msg.msg_iov[0].iov_len -= (size_t)sent;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Every protobuf message on the wire is preceded by its length as a 4-byte
+// big-endian integer, so a reader can split a TCP stream back into messages
+// no matter how the bytes were segmented.
+#define FRAME_HEADER_SIZE 4
+#define FRAME_MAX_PAYLOAD (1024 * 1024)
+#define FRAME_BUFFER_INITIAL_SIZE 4096
+
+// Reusable read buffer that reassembles frames across recv calls
+typedef struct FrameBuffer {
+    uint8_t *data;
+    size_t capacity;
+    size_t start; // first byte not consumed yet
+    size_t end;   // one past the last byte received
+} FrameBuffer;
+
+void frame_buffer_init(FrameBuffer *buffer);
+void frame_buffer_free(FrameBuffer *buffer);
+void frame_buffer_release(FrameBuffer *buffer);
+ssize_t frame_buffer_recv(FrameBuffer *buffer, int socket_fd);
+int frame_buffer_next(FrameBuffer *buffer, const uint8_t **payload, size_t *len);
+
+void frame_write_header(uint8_t *header, size_t len);
+bool frame_send(int socket_fd, const void *payload, size_t len);
+
+#endif
@@ -0,0 +1,78 @@
+#include "histogram.h"
+#include <string.h>
+
+void histogram_init(Histogram *histogram) {
+    memset(histogram, 0, sizeof(Histogram));
+    histogram->min = UINT64_MAX;
+}
+
+size_t histogram_bucket(uint64_t value) {
+    if (value < 2 * HISTOGRAM_SUB_BUCKETS) {
+        return (size_t)value;
+    }
+    // value >> shift lands in [64, 128)
+    unsigned exponent = 63 - (unsigned)__builtin_clzll(value);
+    unsigned shift = exponent - 6;
+    return 2 * HISTOGRAM_SUB_BUCKETS + (exponent - 7) * HISTOGRAM_SUB_BUCKETS + (size_t)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+static uint64_t histogram_bucket_value(size_t bucket) {
+    if (bucket < 2 * HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t offset = bucket - 2 * HISTOGRAM_SUB_BUCKETS;
+    unsigned shift = (unsigned)(offset / HISTOGRAM_SUB_BUCKETS) + 1;
+    uint64_t low = (uint64_t)(offset % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS) << shift;
+    return low + ((uint64_t)1 << shift) / 2;
+}
+
+void histogram_record(Histogram *histogram, uint64_t value) {
+    histogram->counts[histogram_bucket(value)]++;
+    histogram->total++;
+    histogram->sum += value;
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+void histogram_merge(Histogram *into, const Histogram *from) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+    if (from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+uint64_t histogram_percentile(const Histogram *histogram, double quantile) {
+    if (histogram->total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(quantile * (double)histogram->total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            uint64_t value = histogram_bucket_value(i);
+            return value > histogram->max ? histogram->max : value;
+        }
+    }
+
+    return histogram->max;
+}
+
+double histogram_mean(const Histogram *histogram) {
+    return histogram->total > 0 ? (double)histogram->sum / (double)histogram->total : 0.0;
+}
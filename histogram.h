@@ -0,0 +1,32 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log-linear latency histogram in the style of HdrHistogram: values below
+// 128 get a bucket each, every power of two above that is split into 64
+// buckets, so any recorded value is known to within ~1.6% using a fixed
+// 30 KiB of counters and no allocation while recording.
+#define HISTOGRAM_SUB_BUCKETS 64
+#define HISTOGRAM_BUCKETS (2 * HISTOGRAM_SUB_BUCKETS + (64 - 7) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct Histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+} Histogram;
+
+void histogram_init(Histogram *histogram);
+// Bucket a value is counted in, for callers that keep their own counters
+size_t histogram_bucket(uint64_t value);
+void histogram_record(Histogram *histogram, uint64_t value);
+void histogram_merge(Histogram *into, const Histogram *from);
+// Smallest recorded value v such that `quantile` of all values are <= v,
+// rounded to its bucket's midpoint
+uint64_t histogram_percentile(const Histogram *histogram, double quantile);
+double histogram_mean(const Histogram *histogram);
+
+#endif
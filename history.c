@@ -0,0 +1,171 @@
+#include "history.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t round_up_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+bool history_init(History *history, size_t byte_capacity, size_t entry_capacity) {
+    memset(history, 0, sizeof(History));
+    history->byte_capacity = round_up_pow2(byte_capacity);
+    history->entry_capacity = round_up_pow2(entry_capacity);
+    history->bytes = (uint8_t *)malloc(history->byte_capacity);
+    history->entries = (HistoryEntry *)calloc(history->entry_capacity, sizeof(HistoryEntry));
+    if (history->bytes == NULL || history->entries == NULL) {
+        free(history->bytes);
+        free(history->entries);
+        return false;
+    }
+    if (pthread_mutex_init(&history->producer_mutex, NULL) != 0) {
+        free(history->bytes);
+        free(history->entries);
+        return false;
+    }
+    atomic_init(&history->reserved, 0);
+    atomic_init(&history->next_seq, 1);
+
+    return true;
+}
+
+void history_destroy(History *history) {
+    pthread_mutex_destroy(&history->producer_mutex);
+    free(history->bytes);
+    free(history->entries);
+}
+
+// Copy [pos, pos + len) out of and into the ring, wrapping at the end
+static void ring_read(History *history, uint64_t pos, uint8_t *dst, size_t len) {
+    size_t offset = pos & (history->byte_capacity - 1);
+    size_t first = history->byte_capacity - offset < len ? history->byte_capacity - offset : len;
+    memcpy(dst, history->bytes + offset, first);
+    memcpy(dst + first, history->bytes, len - first);
+}
+
+static void ring_write(History *history, uint64_t pos, const uint8_t *src, size_t len) {
+    size_t offset = pos & (history->byte_capacity - 1);
+    size_t first = history->byte_capacity - offset < len ? history->byte_capacity - offset : len;
+    memcpy(history->bytes + offset, src, first);
+    memcpy(history->bytes, src + first, len - first);
+}
+
+uint64_t history_append(History *history, const uint8_t *data, size_t len) {
+    if (len > history->byte_capacity) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&history->producer_mutex);
+    uint64_t seq = atomic_load_explicit(&history->next_seq, memory_order_relaxed);
+    uint64_t pos = history->write_pos;
+    HistoryEntry *entry = &history->entries[seq & (history->entry_capacity - 1)];
+
+    // Announce the bytes and the slot about to be clobbered before touching
+    // them, so a reader that copied either can tell
+    atomic_store_explicit(&history->reserved, pos + len, memory_order_relaxed);
+    atomic_store_explicit(&entry->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    ring_write(history, pos, data, len);
+    atomic_store_explicit(&entry->pos, pos, memory_order_relaxed);
+    atomic_store_explicit(&entry->len, (uint32_t)len, memory_order_relaxed);
+    atomic_store_explicit(&entry->seq, seq, memory_order_release);
+
+    history->write_pos = pos + len;
+    atomic_store_explicit(&history->next_seq, seq + 1, memory_order_release);
+    pthread_mutex_unlock(&history->producer_mutex);
+
+    return seq;
+}
+
+uint64_t history_last_seq(History *history) {
+    return atomic_load_explicit(&history->next_seq, memory_order_acquire) - 1;
+}
+
+// Reads the slot of `seq`; false if the slot has moved on to a newer message
+static bool history_entry(History *history, uint64_t seq, uint64_t *pos, uint32_t *len) {
+    HistoryEntry *entry = &history->entries[seq & (history->entry_capacity - 1)];
+    if (atomic_load_explicit(&entry->seq, memory_order_acquire) != seq) {
+        return false;
+    }
+    *pos = atomic_load_explicit(&entry->pos, memory_order_relaxed);
+    *len = atomic_load_explicit(&entry->len, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+
+    return atomic_load_explicit(&entry->seq, memory_order_relaxed) == seq;
+}
+
+// First message in [first, end) whose bytes start at or after `oldest`;
+// positions grow with sequence numbers, so this is a binary search
+static uint64_t history_first_after(History *history, uint64_t first, uint64_t end, uint64_t oldest) {
+    while (first < end) {
+        uint64_t mid = first + (end - first) / 2;
+        uint64_t pos;
+        uint32_t len;
+        if (history_entry(history, mid, &pos, &len) && pos >= oldest) {
+            end = mid;
+        } else {
+            first = mid + 1;
+        }
+    }
+    return first;
+}
+
+SharedBuffer *history_replay_from(History *history, uint64_t first_seq, size_t count, uint64_t *last_seq) {
+    // Messages are stored back to back, so the whole range is one copy. A
+    // writer lapping us mid-copy only costs a retry on a newer range.
+    for (int attempt = 0; attempt < HISTORY_REPLAY_ATTEMPTS; attempt++) {
+        uint64_t end = atomic_load_explicit(&history->next_seq, memory_order_acquire);
+        uint64_t first = first_seq > 0 ? first_seq : 1;
+        if (first >= end) {
+            return NULL;
+        }
+        if (end - first > count) {
+            end = first + count;
+        }
+        if (end - first > history->entry_capacity) {
+            first = end - history->entry_capacity;
+        }
+        uint64_t reserved = atomic_load_explicit(&history->reserved, memory_order_relaxed);
+        uint64_t oldest = reserved > history->byte_capacity ? reserved - history->byte_capacity : 0;
+
+        // Slots can outlive the bytes they point to
+        first = history_first_after(history, first, end, oldest);
+        if (first >= end) {
+            return NULL;
+        }
+
+        uint64_t start, last_pos;
+        uint32_t first_len, last_len;
+        if (!history_entry(history, first, &start, &first_len) ||
+            !history_entry(history, end - 1, &last_pos, &last_len)) {
+            continue;
+        }
+
+        size_t total = (size_t)(last_pos + last_len - start);
+        SharedBuffer *buffer = shared_buffer_new(total);
+        if (buffer == NULL) {
+            return NULL;
+        }
+        ring_read(history, start, buffer->data, total);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&history->reserved, memory_order_relaxed) - start <= history->byte_capacity) {
+            if (last_seq != NULL) {
+                *last_seq = end - 1;
+            }
+            return buffer;
+        }
+        shared_buffer_unref(buffer);
+    }
+
+    return NULL;
+}
+
+SharedBuffer *history_replay_last(History *history, size_t count) {
+    uint64_t end = atomic_load_explicit(&history->next_seq, memory_order_acquire);
+    return history_replay_from(history, end - 1 < count ? 1 : end - count, count, NULL);
+}
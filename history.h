@@ -0,0 +1,55 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "shared_buffer.h"
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define HISTORY_DEFAULT_BYTES (4 * 1024 * 1024)
+#define HISTORY_DEFAULT_ENTRIES 4096
+#define HISTORY_REPLAY_DEFAULT 20
+#define HISTORY_REPLAY_ATTEMPTS 8
+
+// Where message `seq` sits in the byte ring. The fields are rewritten in
+// place when the slot is reused, so readers check seq before and after.
+typedef struct HistoryEntry {
+    _Atomic uint64_t seq;
+    _Atomic uint64_t pos;
+    _Atomic uint32_t len;
+} HistoryEntry;
+
+// Fixed-size ring of the most recent broadcasts, kept as the framed bytes
+// sent to clients. Appends are serialized by producer_mutex; readers never
+// lock, they copy and then check that the writer did not lap them.
+// Positions are monotonic byte offsets, masked into the ring on access.
+typedef struct History {
+    uint8_t *bytes;
+    size_t byte_capacity;
+    HistoryEntry *entries;
+    size_t entry_capacity;
+
+    pthread_mutex_t producer_mutex;
+    uint64_t write_pos;          // producer only
+    _Atomic uint64_t reserved;   // bytes below this may be being overwritten
+    _Atomic uint64_t next_seq;   // sequence numbers start at 1
+} History;
+
+// Capacities are rounded up to powers of two
+bool history_init(History *history, size_t byte_capacity, size_t entry_capacity);
+void history_destroy(History *history);
+// Copies the frame into the ring; returns its sequence number, or 0 if it
+// is larger than the whole ring
+uint64_t history_append(History *history, const uint8_t *data, size_t len);
+uint64_t history_last_seq(History *history);
+// The newest `count` messages still in the ring, concatenated in order into
+// one buffer; NULL if there are none
+SharedBuffer *history_replay_last(History *history, size_t count);
+// Up to `count` messages from `first_seq` on, or from the oldest one still
+// in the ring if it has moved past it, in one buffer like the above.
+// `last_seq` gets the sequence number of the last one copied.
+SharedBuffer *history_replay_from(History *history, uint64_t first_seq, size_t count, uint64_t *last_seq);
+
+#endif
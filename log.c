@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "log.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+static const char *level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+static LogLevel log_min_level = LOG_INFO;
+static int log_fd = -1;
+static atomic_bool log_running;
+
+// Every ring ever handed out, live or waiting to be reused. Rings are only
+// ever prepended, so the flusher walks the list without the mutex; the
+// mutex is for threads picking a ring the first time they log.
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LogRing *_Atomic rings = NULL;
+static pthread_key_t ring_key;
+static __thread LogRing *local_ring = NULL;
+
+static uint64_t log_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// pthread key destructor: the flusher writes what is left, then the ring
+// goes to the next thread that logs
+static void log_ring_retire(void *ring) {
+    atomic_store_explicit(&((LogRing *)ring)->retired, true, memory_order_release);
+}
+
+static LogRing *log_ring(void) {
+    if (local_ring != NULL) {
+        return local_ring;
+    }
+
+    pthread_mutex_lock(&rings_mutex);
+    LogRing *ring = NULL;
+    for (LogRing *candidate = atomic_load_explicit(&rings, memory_order_relaxed); candidate != NULL; candidate = candidate->next) {
+        // Drained retired rings only; the flusher may still be reading others
+        if (atomic_load_explicit(&candidate->retired, memory_order_acquire) &&
+            atomic_load_explicit(&candidate->head, memory_order_acquire) == atomic_load_explicit(&candidate->tail, memory_order_relaxed)) {
+            ring = candidate;
+            break;
+        }
+    }
+    if (ring == NULL) {
+        ring = (LogRing *)calloc(1, sizeof(LogRing));
+        if (ring != NULL) {
+            ring->next = atomic_load_explicit(&rings, memory_order_relaxed);
+            atomic_store_explicit(&rings, ring, memory_order_release);
+        }
+    }
+    if (ring != NULL) {
+        ring->window_start = 0;
+        ring->window_lines = 0;
+        ring->stamp_second = 0;
+        atomic_store_explicit(&ring->retired, false, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&rings_mutex);
+
+    if (ring != NULL) {
+        pthread_setspecific(ring_key, ring);
+    }
+    local_ring = ring;
+    return ring;
+}
+
+// Token-bucket-ish: LOG_RATE_LIMIT lines per one-second window
+static bool log_allowed(LogRing *ring) {
+    uint64_t now = log_now_ns();
+    if (now - ring->window_start >= 1000000000ull) {
+        ring->window_start = now;
+        ring->window_lines = 0;
+    }
+    return ring->window_lines++ < LOG_RATE_LIMIT;
+}
+
+// "HH:MM:SS", reformatted at most once a second per thread
+static const char *log_stamp(LogRing *ring, long *millis) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    *millis = ts.tv_nsec / 1000000;
+    if (ts.tv_sec != ring->stamp_second) {
+        struct tm tm;
+        localtime_r(&ts.tv_sec, &tm);
+        strftime(ring->stamp, sizeof(ring->stamp), "%H:%M:%S", &tm);
+        ring->stamp_second = ts.tv_sec;
+    }
+    return ring->stamp;
+}
+
+void log_write(LogLevel level, const char *format, ...) {
+    if (level < log_min_level) {
+        return;
+    }
+
+    // For %m: picking a ring may call into libc
+    int saved_errno = errno;
+    va_list args;
+    LogRing *ring = atomic_load_explicit(&log_running, memory_order_acquire) ? log_ring() : NULL;
+    if (ring == NULL) {
+        // No flusher yet: write synchronously like before
+        errno = saved_errno;
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+        fputc('\n', stderr);
+        return;
+    }
+
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING_SLOTS || !log_allowed(ring)) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    LogLine *line = &ring->lines[tail % LOG_RING_SLOTS];
+    long millis;
+    const char *stamp = log_stamp(ring, &millis);
+    int len = snprintf(line->text, LOG_LINE_MAX, "%s.%03ld %-5s ", stamp, millis, level_names[level]);
+    errno = saved_errno;
+    va_start(args, format);
+    int body = vsnprintf(line->text + len, LOG_LINE_MAX - (size_t)len, format, args);
+    va_end(args);
+    len = body < 0 ? len : len + body;
+    if (len > LOG_LINE_MAX - 1) {
+        len = LOG_LINE_MAX - 1; // truncated; the newline still fits
+    }
+    line->text[len++] = '\n';
+    line->len = (uint16_t)len;
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static void log_write_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(log_fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // nowhere left to report it
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+}
+
+// Gathers the pending lines of every ring into one writev, then lets the
+// owners reuse the slots
+static void log_flush(void) {
+    static struct iovec iov[LOG_RING_SLOTS * 16];
+    static char notice[LOG_LINE_MAX];
+    uint64_t dropped = 0;
+
+    LogRing *ring = atomic_load_explicit(&rings, memory_order_acquire);
+    while (ring != NULL) {
+        LogRing *batch_start = ring;
+        int count = 0;
+        for (; ring != NULL && count + LOG_RING_SLOTS <= (int)(sizeof(iov) / sizeof(iov[0])); ring = ring->next) {
+            uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            ring->flushing = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            for (uint32_t i = head; i != ring->flushing; i++) {
+                LogLine *line = &ring->lines[i % LOG_RING_SLOTS];
+                iov[count].iov_base = line->text;
+                iov[count].iov_len = line->len;
+                count++;
+            }
+            dropped += atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        }
+        log_write_all(iov, count);
+
+        // Only now may the owners overwrite what was just written
+        for (LogRing *done = batch_start; done != ring; done = done->next) {
+            atomic_store_explicit(&done->head, done->flushing, memory_order_release);
+        }
+    }
+
+    if (dropped > 0) {
+        int len = snprintf(notice, sizeof(notice), "[log] %llu líneas descartadas por límite de tasa o búfer lleno\n", (unsigned long long)dropped);
+        struct iovec note = { notice, (size_t)len };
+        log_write_all(&note, 1);
+    }
+}
+
+static void *log_flusher_thread(void *unused) {
+    struct timespec interval = { 0, LOG_FLUSH_INTERVAL_MS * 1000000L };
+    while (1) {
+        nanosleep(&interval, NULL);
+        log_flush();
+    }
+    return NULL;
+}
+
+bool log_parse_level(const char *name, LogLevel *level) {
+    for (int i = LOG_DEBUG; i <= LOG_ERROR; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            *level = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool log_init(int fd, LogLevel min_level) {
+    log_fd = fd;
+    log_min_level = min_level;
+    if (pthread_key_create(&ring_key, log_ring_retire) != 0) {
+        return false;
+    }
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, log_flusher_thread, NULL) != 0) {
+        return false;
+    }
+    pthread_detach(thread_id);
+    atomic_store_explicit(&log_running, true, memory_order_release);
+
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define LOG_LINE_MAX 256
+#define LOG_RING_SLOTS 64
+#define LOG_FLUSH_INTERVAL_MS 20
+// Lines per second each thread may log before the rest are suppressed
+#define LOG_RATE_LIMIT 1000
+
+typedef enum LogLevel {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+} LogLevel;
+
+typedef struct LogLine {
+    uint16_t len;
+    char text[LOG_LINE_MAX];
+} LogLine;
+
+// Single-producer ring owned by one thread; the flusher is the only
+// consumer. A full ring drops the line rather than wait.
+typedef struct LogRing {
+    LogLine lines[LOG_RING_SLOTS];
+    _Atomic uint32_t head; // next line the flusher writes
+    _Atomic uint32_t tail; // next slot the owner fills
+    _Atomic uint64_t dropped;
+    atomic_bool retired;   // owner exited; recycled once drained
+    uint32_t flushing;     // flusher only: tail of the batch being written
+    // Owner-only state
+    uint64_t window_start;
+    uint32_t window_lines;
+    time_t stamp_second;
+    char stamp[16];
+    struct LogRing *next;
+} LogRing;
+
+// Starts the background flusher writing to `fd`. Lines logged before this,
+// or when it fails, go straight to stderr.
+bool log_init(int fd, LogLevel min_level);
+bool log_parse_level(const char *name, LogLevel *level);
+void log_write(LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// %m in the format expands to strerror(errno), as with syslog
+#define log_debug(...) log_write(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) log_write(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) log_write(LOG_WARN, __VA_ARGS__)
+#define log_error(...) log_write(LOG_ERROR, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,140 @@
+#include "mailbox.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t mailbox_hash(const char *user_name, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)user_name[i];
+        hash *= 1099511628211ULL;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// The high hash bits pick the shard, the low ones the bucket inside it
+static MailboxShard *mailbox_shard_for(Mailboxes *mailboxes, uint32_t hash) {
+    return &mailboxes->shards[(hash >> 28) % MAILBOX_SHARDS];
+}
+
+static Mailbox **mailbox_find(MailboxShard *shard, const char *user_name, uint32_t hash) {
+    Mailbox **link = &shard->buckets[hash & (MAILBOX_BUCKETS - 1)];
+    while (*link != NULL && ((*link)->hash != hash || strcmp((*link)->user_name, user_name) != 0)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+bool mailbox_init(Mailboxes *mailboxes) {
+    memset(mailboxes, 0, sizeof(*mailboxes));
+    for (int i = 0; i < MAILBOX_SHARDS; i++) {
+        if (pthread_mutex_init(&mailboxes->shards[i].mutex, NULL) != 0) {
+            return false;
+        }
+    }
+    atomic_init(&mailboxes->total_bytes, 0);
+    return true;
+}
+
+// Makes room for `more` bytes, doubling the buffer so a long backlog is
+// copied O(log n) times. Called with the shard mutex held.
+static bool mailbox_reserve(Mailbox *mailbox, size_t more) {
+    size_t capacity = mailbox->pending != NULL ? mailbox->pending->len : 0;
+    if (mailbox->used + more <= capacity) {
+        return true;
+    }
+    capacity = capacity > 0 ? capacity * 2 : 1024;
+    while (capacity < mailbox->used + more) {
+        capacity *= 2;
+    }
+    SharedBuffer *grown = shared_buffer_new(capacity);
+    if (grown == NULL) {
+        return false;
+    }
+    if (mailbox->pending != NULL) {
+        memcpy(grown->data, mailbox->pending->data, mailbox->used);
+        shared_buffer_unref(mailbox->pending);
+    }
+    mailbox->pending = grown;
+    return true;
+}
+
+MailboxStatus mailbox_store(Mailboxes *mailboxes, const char *user_name, SharedBuffer *delivery,
+                            MailboxDeliver deliver, void *context) {
+    size_t len = strlen(user_name);
+    if (len == 0 || len > USER_NAME_MAX) {
+        return MAILBOX_INVALID_NAME;
+    }
+    uint32_t hash = mailbox_hash(user_name, len);
+    MailboxShard *shard = mailbox_shard_for(mailboxes, hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    if (deliver(user_name, delivery, context)) {
+        pthread_mutex_unlock(&shard->mutex);
+        return MAILBOX_DELIVERED;
+    }
+
+    Mailbox **link = mailbox_find(shard, user_name, hash);
+    Mailbox *mailbox = *link;
+    size_t used = mailbox != NULL ? mailbox->used : 0;
+    if (used + delivery->len > MAILBOX_MAX_BYTES) {
+        pthread_mutex_unlock(&shard->mutex);
+        return MAILBOX_FULL;
+    }
+    // Names nobody registers can still be written to, so all mailboxes
+    // together are bounded too
+    if (atomic_fetch_add(&mailboxes->total_bytes, delivery->len) + delivery->len > MAILBOX_TOTAL_BYTES) {
+        atomic_fetch_sub(&mailboxes->total_bytes, delivery->len);
+        pthread_mutex_unlock(&shard->mutex);
+        return MAILBOX_FULL;
+    }
+    if (mailbox == NULL) {
+        mailbox = (Mailbox *)calloc(1, sizeof(Mailbox));
+        if (mailbox == NULL) {
+            atomic_fetch_sub(&mailboxes->total_bytes, delivery->len);
+            pthread_mutex_unlock(&shard->mutex);
+            return MAILBOX_NO_MEMORY;
+        }
+        mailbox->hash = hash;
+        memcpy(mailbox->user_name, user_name, len + 1);
+        *link = mailbox;
+    }
+    if (!mailbox_reserve(mailbox, delivery->len)) {
+        atomic_fetch_sub(&mailboxes->total_bytes, delivery->len);
+        pthread_mutex_unlock(&shard->mutex);
+        return MAILBOX_NO_MEMORY;
+    }
+    memcpy(mailbox->pending->data + mailbox->used, delivery->data, delivery->len);
+    mailbox->used += delivery->len;
+    mailbox->count++;
+    pthread_mutex_unlock(&shard->mutex);
+
+    return MAILBOX_STORED;
+}
+
+SharedBuffer *mailbox_take(Mailboxes *mailboxes, const char *user_name, size_t *count) {
+    size_t len = strlen(user_name);
+    uint32_t hash = mailbox_hash(user_name, len);
+    MailboxShard *shard = mailbox_shard_for(mailboxes, hash);
+    *count = 0;
+
+    pthread_mutex_lock(&shard->mutex);
+    Mailbox **link = mailbox_find(shard, user_name, hash);
+    Mailbox *mailbox = *link;
+    if (mailbox == NULL) {
+        pthread_mutex_unlock(&shard->mutex);
+        return NULL;
+    }
+    *link = mailbox->next;
+    pthread_mutex_unlock(&shard->mutex);
+
+    atomic_fetch_sub(&mailboxes->total_bytes, mailbox->used);
+    // Only the filled part goes out; the buffer is nobody else's yet
+    SharedBuffer *pending = mailbox->pending;
+    if (pending != NULL) {
+        pending->len = mailbox->used;
+    }
+    *count = mailbox->count;
+    free(mailbox);
+
+    return pending;
+}
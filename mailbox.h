@@ -0,0 +1,63 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "registry.h"
+#include "shared_buffer.h"
+
+#define MAILBOX_MAX_BYTES (256 * 1024)         // per user
+#define MAILBOX_TOTAL_BYTES (64 * 1024 * 1024) // over every mailbox
+#define MAILBOX_SHARDS 16
+#define MAILBOX_BUCKETS 256 // per shard, power of two
+
+typedef enum MailboxStatus {
+    MAILBOX_DELIVERED, // the user was online after all
+    MAILBOX_STORED,
+    MAILBOX_FULL,
+    MAILBOX_INVALID_NAME,
+    MAILBOX_NO_MEMORY
+} MailboxStatus;
+
+// Direct messages waiting for a user who is not connected, kept as the
+// framed deliveries back to back in one buffer. When the user registers
+// the buffer is handed over whole, so the backlog goes out in as few
+// writes as the socket allows instead of one send per message.
+typedef struct Mailbox {
+    struct Mailbox *next; // bucket chain
+    uint32_t hash;
+    SharedBuffer *pending; // not shared until taken; len is its capacity
+    size_t used;
+    size_t count;
+    char user_name[USER_NAME_MAX + 1];
+} Mailbox;
+
+typedef struct MailboxShard {
+    pthread_mutex_t mutex;
+    Mailbox *buckets[MAILBOX_BUCKETS];
+} MailboxShard;
+
+typedef struct Mailboxes {
+    MailboxShard shards[MAILBOX_SHARDS];
+    _Atomic size_t total_bytes;
+} Mailboxes;
+
+// Tries to hand the delivery to the user if they are connected; true if
+// it was queued to them
+typedef bool (*MailboxDeliver)(const char *user_name, SharedBuffer *delivery, void *context);
+
+bool mailbox_init(Mailboxes *mailboxes);
+// `deliver` is tried again under the mailbox lock before storing: a user
+// who registers meanwhile either gets the message directly or finds it
+// in the mailbox, as long as registration adds the user to the registry
+// before calling mailbox_take.
+MailboxStatus mailbox_store(Mailboxes *mailboxes, const char *user_name, SharedBuffer *delivery,
+                            MailboxDeliver deliver, void *context);
+// The user's pending deliveries in one buffer, or NULL if there are none.
+// The mailbox is emptied; `count` gets how many messages it held.
+SharedBuffer *mailbox_take(Mailboxes *mailboxes, const char *user_name, size_t *count);
+
+#endif
@@ -0,0 +1,489 @@
+#include "message_log.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+        crc_table[i] = crc;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc(const MessageLogRecord *record, const uint8_t *data) {
+    uint32_t crc = crc_update(0, (const uint8_t *)&record->kind, sizeof(record->kind));
+    crc = crc_update(crc, (const uint8_t *)&record->thread, sizeof(record->thread));
+    return crc_update(crc, data, record->len);
+}
+
+static void segment_unref(MessageLogSegment *segment) {
+    if (atomic_fetch_sub_explicit(&segment->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    munmap(segment->map, segment->size);
+    close(segment->fd);
+    free(segment->index);
+    free(segment);
+}
+
+static bool segment_add_index(MessageLogSegment *segment, uint64_t offset, size_t pos) {
+    if (segment->index_count == segment->index_capacity) {
+        size_t capacity = segment->index_capacity > 0 ? segment->index_capacity * 2 : 64;
+        MessageLogIndexEntry *index = (MessageLogIndexEntry *)realloc(segment->index, capacity * sizeof(MessageLogIndexEntry));
+        if (index == NULL) {
+            return false;
+        }
+        segment->index = index;
+        segment->index_capacity = capacity;
+    }
+    segment->index[segment->index_count].offset = offset;
+    segment->index[segment->index_count].pos = pos;
+    segment->index_count++;
+    return true;
+}
+
+// Walks the records of a segment from a previous run up to the first one
+// that is missing or torn, rebuilding the index on the way
+static bool segment_scan(MessageLogSegment *segment) {
+    size_t pos = sizeof(MessageLogSegmentHeader);
+    while (pos + sizeof(MessageLogRecord) <= segment->size) {
+        MessageLogRecord record;
+        memcpy(&record, segment->map + pos, sizeof(record));
+        if (record.len == 0 || record.len > segment->size - pos - sizeof(record)) {
+            break;
+        }
+        const uint8_t *payload = segment->map + pos + sizeof(record);
+        if (record.crc != record_crc(&record, payload)) {
+            break;
+        }
+        if (segment->record_count % MESSAGE_LOG_INDEX_INTERVAL == 0 &&
+            !segment_add_index(segment, segment->base_offset + segment->record_count, pos)) {
+            return false;
+        }
+        pos += sizeof(record) + record.len;
+        segment->record_count++;
+    }
+    segment->used = segment->synced = pos;
+    return true;
+}
+
+// Makes sure a scan stops right after the last record even if older bytes
+// follow it, e.g. the rest of a record torn by a crash
+static void segment_mark_end(MessageLogSegment *segment) {
+    if (segment->used + sizeof(MessageLogRecord) <= segment->size) {
+        memset(segment->map + segment->used, 0, sizeof(MessageLogRecord));
+    }
+}
+
+// Checks the header of a segment from a previous run. One left all zeros
+// by a crash right after the file was created gets its header now.
+static bool segment_check_header(MessageLogSegment *segment) {
+    MessageLogSegmentHeader header;
+    memcpy(&header, segment->map, sizeof(header));
+    if (header.magic == 0 && header.version == 0 && header.base_offset == 0) {
+        header.magic = MESSAGE_LOG_MAGIC;
+        header.version = MESSAGE_LOG_VERSION;
+        header.base_offset = segment->base_offset;
+        memcpy(segment->map, &header, sizeof(header));
+        return msync(segment->map, sizeof(header), MS_SYNC) == 0;
+    }
+    if (header.magic != MESSAGE_LOG_MAGIC || header.version != MESSAGE_LOG_VERSION ||
+        header.base_offset != segment->base_offset) {
+        log_error("El segmento %s no es de la versión %d del registro de mensajes", segment->path, MESSAGE_LOG_VERSION);
+        errno = EPROTO;
+        return false;
+    }
+    return true;
+}
+
+static MessageLogSegment *segment_map(const char *dir, uint64_t base_offset, bool create) {
+    size_t path_len = strlen(dir) + 32;
+    MessageLogSegment *segment = (MessageLogSegment *)calloc(1, sizeof(MessageLogSegment) + path_len);
+    if (segment == NULL) {
+        return NULL;
+    }
+    snprintf(segment->path, path_len, "%s/%020llu.log", dir, (unsigned long long)base_offset);
+    atomic_init(&segment->refs, 1);
+    segment->base_offset = base_offset;
+
+    segment->fd = open(segment->path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (segment->fd < 0) {
+        free(segment);
+        return NULL;
+    }
+    // Blocks are reserved up front: a store through the map to a hole the
+    // disk has no room for would be a SIGBUS, not an error
+    struct stat st;
+    int err = fstat(segment->fd, &st) < 0 ? errno : 0;
+    if (err == 0 && st.st_size < MESSAGE_LOG_SEGMENT_BYTES) {
+        err = posix_fallocate(segment->fd, 0, MESSAGE_LOG_SEGMENT_BYTES);
+        st.st_size = MESSAGE_LOG_SEGMENT_BYTES;
+    }
+    if (err == 0 && create) {
+        MessageLogSegmentHeader header = { MESSAGE_LOG_MAGIC, MESSAGE_LOG_VERSION, base_offset };
+        ssize_t written = pwrite(segment->fd, &header, sizeof(header), 0);
+        if (written != (ssize_t)sizeof(header)) {
+            err = written < 0 ? errno : EIO;
+        } else if (fsync(segment->fd) < 0) {
+            err = errno;
+        }
+    }
+    if (err == 0) {
+        segment->size = (size_t)st.st_size;
+        segment->map = (uint8_t *)mmap(NULL, segment->size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+        if (segment->map == MAP_FAILED) {
+            err = errno;
+        } else if (!create && !segment_check_header(segment)) {
+            err = errno;
+            munmap(segment->map, segment->size);
+        }
+    }
+    if (err != 0) {
+        close(segment->fd);
+        if (create) {
+            unlink(segment->path);
+        }
+        free(segment);
+        errno = err;
+        return NULL;
+    }
+    segment->used = segment->synced = sizeof(MessageLogSegmentHeader);
+
+    return segment;
+}
+
+static bool log_push_segment(MessageLog *log, MessageLogSegment *segment) {
+    MessageLogSegment **segments = (MessageLogSegment **)realloc(log->segments, (log->segment_count + 1) * sizeof(MessageLogSegment *));
+    if (segments == NULL) {
+        return false;
+    }
+    log->segments = segments;
+    log->segments[log->segment_count++] = segment;
+    return true;
+}
+
+// Drops the oldest segments past max_segments, once they are on disk.
+// Readers still holding one keep its map until they are done.
+static void log_trim(MessageLog *log) {
+    while (log->segment_count > log->max_segments && log->segments[0]->synced == log->segments[0]->used) {
+        MessageLogSegment *oldest = log->segments[0];
+        memmove(log->segments, log->segments + 1, (log->segment_count - 1) * sizeof(MessageLogSegment *));
+        log->segment_count--;
+        if (unlink(oldest->path) < 0) {
+            log_error("Error al borrar el segmento %s: %m", oldest->path);
+        }
+        segment_unref(oldest);
+    }
+}
+
+// Starts a new segment at next_offset. Called with the mutex held.
+static MessageLogSegment *log_roll(MessageLog *log) {
+    MessageLogSegment *segment = segment_map(log->dir, log->next_offset, true);
+    if (segment == NULL) {
+        log_error("Error al crear un segmento del registro de mensajes: %m");
+        return NULL;
+    }
+    if (!log_push_segment(log, segment)) {
+        unlink(segment->path);
+        segment_unref(segment);
+        return NULL;
+    }
+    segment_mark_end(segment);
+    // The new file's directory entry has to survive a crash too
+    int dir_fd = open(log->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    log_trim(log);
+
+    return segment;
+}
+
+uint64_t message_log_append(MessageLog *log, MessageLogKind kind, uint32_t thread, const uint8_t *data, size_t len) {
+    size_t need = sizeof(MessageLogRecord) + len;
+    if (need > MESSAGE_LOG_SEGMENT_BYTES - sizeof(MessageLogSegmentHeader)) {
+        return MESSAGE_LOG_NONE;
+    }
+
+    pthread_mutex_lock(&log->mutex);
+    MessageLogSegment *segment = log->segment_count > 0 ? log->segments[log->segment_count - 1] : NULL;
+    if (segment == NULL || segment->used + need > segment->size) {
+        segment = log_roll(log);
+        if (segment == NULL) {
+            pthread_mutex_unlock(&log->mutex);
+            return MESSAGE_LOG_NONE;
+        }
+    }
+
+    uint64_t offset = log->next_offset++;
+    if (segment->record_count % MESSAGE_LOG_INDEX_INTERVAL == 0) {
+        // A missing entry only makes reads of this stretch scan further
+        segment_add_index(segment, offset, segment->used);
+    }
+    MessageLogRecord record = { (uint32_t)len, 0, kind, thread };
+    record.crc = record_crc(&record, data);
+    memcpy(segment->map + segment->used, &record, sizeof(record));
+    memcpy(segment->map + segment->used + sizeof(record), data, len);
+    segment->used += need;
+    segment->record_count++;
+    segment_mark_end(segment);
+    pthread_cond_signal(&log->appended);
+    pthread_mutex_unlock(&log->mutex);
+
+    return offset;
+}
+
+// Group commit: each pass syncs everything appended since the previous
+// one, so the more messages arrive between syncs the more each one covers
+static void *message_log_committer(void *log_ptr) {
+    MessageLog *log = (MessageLog *)log_ptr;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    struct timespec interval = { 0, MESSAGE_LOG_COMMIT_MS * 1000000L };
+
+    pthread_mutex_lock(&log->mutex);
+    while (1) {
+        MessageLogSegment *segment = NULL;
+        for (size_t i = 0; i < log->segment_count; i++) {
+            if (log->segments[i]->synced < log->segments[i]->used) {
+                segment = log->segments[i];
+                break;
+            }
+        }
+        if (segment == NULL) {
+            pthread_cond_wait(&log->appended, &log->mutex);
+            continue;
+        }
+
+        atomic_fetch_add_explicit(&segment->refs, 1, memory_order_relaxed);
+        size_t from = segment->synced & ~(page - 1);
+        size_t to = segment->used;
+        pthread_mutex_unlock(&log->mutex);
+
+        if (msync(segment->map + from, to - from, MS_SYNC) < 0) {
+            log_error("Error al sincronizar el registro de mensajes: %m");
+        }
+
+        pthread_mutex_lock(&log->mutex);
+        segment->synced = to;
+        segment_unref(segment);
+        log_trim(log);
+
+        pthread_mutex_unlock(&log->mutex);
+        nanosleep(&interval, NULL);
+        pthread_mutex_lock(&log->mutex);
+    }
+
+    return NULL;
+}
+
+uint64_t message_log_first_offset(MessageLog *log) {
+    pthread_mutex_lock(&log->mutex);
+    uint64_t offset = log->segment_count > 0 ? log->segments[0]->base_offset : log->next_offset;
+    pthread_mutex_unlock(&log->mutex);
+    return offset;
+}
+
+uint64_t message_log_next_offset(MessageLog *log) {
+    pthread_mutex_lock(&log->mutex);
+    uint64_t offset = log->next_offset;
+    pthread_mutex_unlock(&log->mutex);
+    return offset;
+}
+
+typedef struct SegmentView {
+    MessageLogSegment *segment;
+    size_t used;
+    uint64_t end_offset;
+    uint64_t start_offset; // where the walk of this segment starts
+    size_t start_pos;
+} SegmentView;
+
+// Position of the last indexed record at or before `offset`. Called with
+// the mutex held: appends may grow the index.
+static void segment_seek(const MessageLogSegment *segment, uint64_t offset, uint64_t *at, size_t *pos) {
+    size_t low = 0;
+    size_t high = segment->index_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (segment->index[middle].offset <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        *at = segment->base_offset;
+        *pos = sizeof(MessageLogSegmentHeader);
+    } else {
+        *at = segment->index[low - 1].offset;
+        *pos = segment->index[low - 1].pos;
+    }
+}
+
+size_t message_log_read(MessageLog *log, uint64_t offset, size_t max_records, MessageLogVisitor visit, void *context) {
+    // Pin the segments from the one holding `offset` on and note how far
+    // each is written; what is below that never changes. Only the first
+    // one needs the index, the others are read from their start.
+    pthread_mutex_lock(&log->mutex);
+    size_t first = 0;
+    while (first + 1 < log->segment_count && log->segments[first + 1]->base_offset <= offset) {
+        first++;
+    }
+    size_t count = log->segment_count - first;
+    SegmentView *views = count > 0 ? (SegmentView *)malloc(count * sizeof(SegmentView)) : NULL;
+    if (views == NULL) {
+        pthread_mutex_unlock(&log->mutex);
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        MessageLogSegment *segment = log->segments[first + i];
+        atomic_fetch_add_explicit(&segment->refs, 1, memory_order_relaxed);
+        views[i].segment = segment;
+        views[i].used = segment->used;
+        views[i].end_offset = segment->base_offset + segment->record_count;
+        views[i].start_offset = segment->base_offset;
+        views[i].start_pos = sizeof(MessageLogSegmentHeader);
+        if (i == 0) {
+            segment_seek(segment, offset, &views[i].start_offset, &views[i].start_pos);
+        }
+    }
+    pthread_mutex_unlock(&log->mutex);
+
+    size_t visited = 0;
+    bool more = true;
+    for (size_t i = 0; i < count && more && visited < max_records; i++) {
+        MessageLogSegment *segment = views[i].segment;
+        if (views[i].end_offset <= offset) {
+            continue;
+        }
+        uint64_t at = views[i].start_offset;
+        size_t pos = views[i].start_pos;
+        while (at < views[i].end_offset && pos < views[i].used && visited < max_records) {
+            MessageLogRecord record;
+            memcpy(&record, segment->map + pos, sizeof(record));
+            if (at >= offset) {
+                visited++;
+                if (!visit(at, &record, segment->map + pos + sizeof(record), context)) {
+                    more = false;
+                    break;
+                }
+            }
+            pos += sizeof(record) + record.len;
+            at++;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        segment_unref(views[i].segment);
+    }
+    free(views);
+    return visited;
+}
+
+static int compare_offsets(const void *a, const void *b) {
+    uint64_t left = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+    return left < right ? -1 : left > right;
+}
+
+// Base offsets of the segment files in dir, sorted; -1 on error
+static ssize_t list_segments(const char *dir, uint64_t **bases) {
+    DIR *handle = opendir(dir);
+    if (handle == NULL) {
+        return -1;
+    }
+    size_t count = 0;
+    size_t capacity = 0;
+    *bases = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL) {
+        char *end;
+        unsigned long long base = strtoull(entry->d_name, &end, 10);
+        if (end != entry->d_name + 20 || strcmp(end, ".log") != 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 16;
+            uint64_t *grown = (uint64_t *)realloc(*bases, capacity * sizeof(uint64_t));
+            if (grown == NULL) {
+                free(*bases);
+                closedir(handle);
+                return -1;
+            }
+            *bases = grown;
+        }
+        (*bases)[count++] = base;
+    }
+    closedir(handle);
+    if (count > 0) {
+        qsort(*bases, count, sizeof(uint64_t), compare_offsets);
+    }
+
+    return (ssize_t)count;
+}
+
+bool message_log_open(MessageLog *log, const char *dir, size_t max_segments) {
+    memset(log, 0, sizeof(*log));
+    crc_init();
+    log->max_segments = max_segments < 2 ? 2 : max_segments;
+    log->dir = strdup(dir);
+    if (log->dir == NULL) {
+        return false;
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+    if (pthread_mutex_init(&log->mutex, NULL) != 0 || pthread_cond_init(&log->appended, NULL) != 0) {
+        return false;
+    }
+
+    uint64_t *bases;
+    ssize_t count = list_segments(dir, &bases);
+    if (count < 0) {
+        return false;
+    }
+    for (ssize_t i = 0; i < count; i++) {
+        MessageLogSegment *segment = segment_map(dir, bases[i], false);
+        if (segment == NULL || !segment_scan(segment) || !log_push_segment(log, segment)) {
+            free(bases);
+            return false;
+        }
+        log->next_offset = segment->base_offset + segment->record_count;
+    }
+    free(bases);
+    if (log->segment_count > 0) {
+        segment_mark_end(log->segments[log->segment_count - 1]);
+    }
+    log_trim(log);
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, message_log_committer, log) != 0) {
+        return false;
+    }
+    pthread_detach(thread_id);
+
+    return true;
+}
@@ -0,0 +1,108 @@
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define MESSAGE_LOG_SEGMENT_BYTES (64 * 1024 * 1024)
+#define MESSAGE_LOG_DEFAULT_SEGMENTS 16
+// One index entry per this many records of a segment
+#define MESSAGE_LOG_INDEX_INTERVAL 64
+// At most one sync this often: bounds what a crash can lose and lets a
+// busy log fold many appends into each sync
+#define MESSAGE_LOG_COMMIT_MS 10
+#define MESSAGE_LOG_NONE UINT64_MAX
+// First bytes of every segment file: "MLOG", then the version of the
+// record layout below. Bumped whenever that layout changes.
+#define MESSAGE_LOG_MAGIC 0x474F4C4Du
+#define MESSAGE_LOG_VERSION 2
+
+typedef enum MessageLogKind {
+    MESSAGE_LOG_BROADCAST = 1,
+    MESSAGE_LOG_DIRECT = 2,
+    MESSAGE_LOG_ROOM = 3
+} MessageLogKind;
+
+// On disk in host byte order, followed by `len` bytes of payload. The CRC
+// covers kind, thread and payload; a zero len marks the end of a segment's
+// records. `thread` is a hash of the conversation the record belongs to,
+// so a reader after one conversation skips the rest without decoding them.
+typedef struct MessageLogRecord {
+    uint32_t len;
+    uint32_t crc;
+    uint32_t kind;
+    uint32_t thread;
+} MessageLogRecord;
+
+// Starts each segment, in host byte order; records follow it. A segment
+// with another magic or version is refused, not scanned: its records
+// would fail the CRC and the log would start over on top of them.
+typedef struct MessageLogSegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t base_offset;
+} MessageLogSegmentHeader;
+
+typedef struct MessageLogIndexEntry {
+    uint64_t offset;
+    size_t pos;
+} MessageLogIndexEntry;
+
+// One preallocated, memory-mapped file holding the records from
+// base_offset on. Records are appended with memcpy into the map and never
+// change afterwards, so readers use the map with no lock once they know
+// how far it is written.
+typedef struct MessageLogSegment {
+    atomic_int refs; // the log holds one while the segment is listed
+    uint64_t base_offset;
+    uint64_t record_count;
+    int fd;
+    uint8_t *map;
+    size_t size;
+    size_t used;   // bytes of records written
+    size_t synced; // bytes known to be on disk
+    // Sparse offset -> position index, one entry per
+    // MESSAGE_LOG_INDEX_INTERVAL records
+    MessageLogIndexEntry *index;
+    size_t index_count;
+    size_t index_capacity;
+    char path[];
+} MessageLogSegment;
+
+// Append-only log of the framed deliveries the server sends, kept in
+// numbered segment files in one directory. Appends only copy into the
+// current segment; a committer thread syncs whatever piled up since its
+// last msync in one go, so a burst of messages costs one sync, not one
+// each, and the send path never waits for the disk. A crash loses at most
+// the records of the last MESSAGE_LOG_COMMIT_MS or so.
+typedef struct MessageLog {
+    pthread_mutex_t mutex;
+    pthread_cond_t appended;
+    char *dir;
+    size_t max_segments;
+    MessageLogSegment **segments; // oldest first
+    size_t segment_count;
+    uint64_t next_offset;
+} MessageLog;
+
+// Called for each record read, in offset order; returning false stops
+typedef bool (*MessageLogVisitor)(uint64_t offset, const MessageLogRecord *record, const uint8_t *data, void *context);
+
+// Opens or creates the log in `dir`, recovering the records of the last
+// run up to the first torn one, and starts the committer. Fails, leaving
+// the files alone, if a segment has another layout.
+bool message_log_open(MessageLog *log, const char *dir, size_t max_segments);
+// Returns the record's offset, or MESSAGE_LOG_NONE if it could not be
+// written
+uint64_t message_log_append(MessageLog *log, MessageLogKind kind, uint32_t thread, const uint8_t *data, size_t len);
+uint64_t message_log_first_offset(MessageLog *log);
+uint64_t message_log_next_offset(MessageLog *log);
+// Visits the records from `offset` on, straight out of the mapped
+// segments, until `max_records` were visited or the visitor says stop.
+// Returns how many were visited.
+size_t message_log_read(MessageLog *log, uint64_t offset, size_t max_records, MessageLogVisitor visit, void *context);
+
+#endif
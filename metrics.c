@@ -0,0 +1,218 @@
+#include "metrics.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+static MetricsShard *_Atomic shards[METRICS_SHARDS];
+static atomic_uint next_shard;
+static __thread MetricsShard *local_shard = NULL;
+static uint64_t started_at;
+static char *dump_path;
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Threads are dealt shards round-robin on first use; a shard is allocated
+// by whichever thread gets to it first and then lives forever
+static MetricsShard *metrics_shard(void) {
+    if (local_shard != NULL) {
+        return local_shard;
+    }
+
+    unsigned index = atomic_fetch_add_explicit(&next_shard, 1, memory_order_relaxed) % METRICS_SHARDS;
+    MetricsShard *shard = atomic_load_explicit(&shards[index], memory_order_acquire);
+    if (shard == NULL) {
+        MetricsShard *fresh = (MetricsShard *)calloc(1, sizeof(MetricsShard));
+        if (fresh == NULL) {
+            return NULL;
+        }
+        if (atomic_compare_exchange_strong_explicit(&shards[index], &shard, fresh, memory_order_acq_rel, memory_order_acquire)) {
+            shard = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    local_shard = shard;
+
+    return shard;
+}
+
+static void atomic_histogram_record(AtomicHistogram *histogram, uint64_t value) {
+    atomic_fetch_add_explicit(&histogram->counts[histogram_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void metrics_add(MetricCounter counter, uint64_t value) {
+    MetricsShard *shard = metrics_shard();
+    if (shard != NULL) {
+        atomic_fetch_add_explicit(&shard->counters[counter], value, memory_order_relaxed);
+    }
+}
+
+void metrics_record(MetricHistogram histogram, uint64_t value) {
+    MetricsShard *shard = metrics_shard();
+    if (shard != NULL) {
+        atomic_histogram_record(&shard->histograms[histogram], value);
+    }
+}
+
+static int metrics_op_slot(int op) {
+    return op > 0 && op < METRICS_MAX_OP ? op : 0;
+}
+
+void metrics_request(int op, uint64_t latency_ns) {
+    MetricsShard *shard = metrics_shard();
+    if (shard != NULL) {
+        atomic_fetch_add_explicit(&shard->requests[metrics_op_slot(op)], 1, memory_order_relaxed);
+        atomic_histogram_record(&shard->latency[metrics_op_slot(op)], latency_ns);
+    }
+}
+
+void metrics_error(int op) {
+    MetricsShard *shard = metrics_shard();
+    if (shard != NULL) {
+        atomic_fetch_add_explicit(&shard->errors[metrics_op_slot(op)], 1, memory_order_relaxed);
+    }
+}
+
+static void atomic_histogram_merge(Histogram *into, AtomicHistogram *from) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        into->counts[i] += atomic_load_explicit(&from->counts[i], memory_order_relaxed);
+    }
+    into->total += atomic_load_explicit(&from->total, memory_order_relaxed);
+    into->sum += atomic_load_explicit(&from->sum, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&from->max, memory_order_relaxed);
+    if (max > into->max) {
+        into->max = max;
+    }
+}
+
+static void metrics_write_histogram(FILE *out, const char *name, const Histogram *histogram, double scale) {
+    fprintf(out, "%s count=%llu mean=%.1f p50=%.1f p99=%.1f p999=%.1f max=%.1f\n", name,
+            (unsigned long long)histogram->total, histogram_mean(histogram) / scale,
+            histogram_percentile(histogram, 0.50) / scale, histogram_percentile(histogram, 0.99) / scale,
+            histogram_percentile(histogram, 0.999) / scale, histogram->max / scale);
+}
+
+// Sums every shard into one plain-text snapshot, written next to `path`
+// and renamed over it so readers never see half a file
+bool metrics_dump(const char *path) {
+    static const char *counter_names[METRIC_COUNTERS] = {
+        "bytes_in", "bytes_out", "sessions_opened", "sessions_closed", "queued_messages", "queued_bytes",
+        "dequeued_messages", "dequeued_bytes", "dropped_messages", "evictions",
+        "heartbeat_timeouts", "offline_stored", "offline_delivered"
+    };
+    uint64_t counters[METRIC_COUNTERS] = { 0 };
+    uint64_t requests[METRICS_MAX_OP] = { 0 };
+    uint64_t errors[METRICS_MAX_OP] = { 0 };
+    Histogram *latency = (Histogram *)calloc(METRICS_MAX_OP + METRIC_HISTOGRAMS, sizeof(Histogram));
+    if (latency == NULL) {
+        return false;
+    }
+    Histogram *histograms = latency + METRICS_MAX_OP;
+
+    for (int s = 0; s < METRICS_SHARDS; s++) {
+        MetricsShard *shard = atomic_load_explicit(&shards[s], memory_order_acquire);
+        if (shard == NULL) {
+            continue;
+        }
+        for (int i = 0; i < METRIC_COUNTERS; i++) {
+            counters[i] += atomic_load_explicit(&shard->counters[i], memory_order_relaxed);
+        }
+        for (int op = 0; op < METRICS_MAX_OP; op++) {
+            requests[op] += atomic_load_explicit(&shard->requests[op], memory_order_relaxed);
+            errors[op] += atomic_load_explicit(&shard->errors[op], memory_order_relaxed);
+            atomic_histogram_merge(&latency[op], &shard->latency[op]);
+        }
+        for (int i = 0; i < METRIC_HISTOGRAMS; i++) {
+            atomic_histogram_merge(&histograms[i], &shard->histograms[i]);
+        }
+    }
+
+    char tmp_path[strlen(path) + 5];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL) {
+        free(latency);
+        return false;
+    }
+
+    fprintf(out, "uptime_seconds %.1f\n", (metrics_now() - started_at) / 1e9);
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        fprintf(out, "%s %llu\n", counter_names[i], (unsigned long long)counters[i]);
+    }
+    // Gauges are differences of monotonic counters; shards are read one
+    // after another, so they can be off by what happened during the dump
+    fprintf(out, "sessions_active %lld\n", (long long)(counters[METRIC_SESSIONS_OPENED] - counters[METRIC_SESSIONS_CLOSED]));
+    fprintf(out, "queue_messages_now %lld\n", (long long)(counters[METRIC_QUEUED_MESSAGES] - counters[METRIC_DEQUEUED_MESSAGES]));
+    fprintf(out, "queue_bytes_now %lld\n", (long long)(counters[METRIC_QUEUED_BYTES] - counters[METRIC_DEQUEUED_BYTES]));
+    metrics_write_histogram(out, "fanout_recipients", &histograms[METRIC_FANOUT], 1.0);
+    metrics_write_histogram(out, "queue_depth_messages", &histograms[METRIC_QUEUE_DEPTH], 1.0);
+    for (int op = 0; op < METRICS_MAX_OP; op++) {
+        if (requests[op] == 0 && errors[op] == 0) {
+            continue;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "op_%d_latency_us", op);
+        fprintf(out, "op_%d_requests %llu\nop_%d_errors %llu\n", op, (unsigned long long)requests[op], op, (unsigned long long)errors[op]);
+        metrics_write_histogram(out, name, &latency[op], 1e3);
+    }
+    free(latency);
+
+    bool ok = fclose(out) == 0;
+    return ok && rename(tmp_path, path) == 0;
+}
+
+static void *metrics_thread(void *unused) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+
+    while (1) {
+        int signal_number;
+        if (sigwait(&signals, &signal_number) != 0) {
+            continue;
+        }
+        if (metrics_dump(dump_path)) {
+            log_info("Métricas escritas en %s", dump_path);
+        } else {
+            log_error("Error al escribir las métricas: %m");
+        }
+    }
+
+    return NULL;
+}
+
+bool metrics_start(const char *path) {
+    started_at = metrics_now();
+    dump_path = strdup(path);
+    if (dump_path == NULL) {
+        return false;
+    }
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+        return false;
+    }
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, metrics_thread, NULL) != 0) {
+        return false;
+    }
+    pthread_detach(thread_id);
+
+    return true;
+}
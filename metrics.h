@@ -0,0 +1,70 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "histogram.h"
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Requests are keyed by UserOption.op; anything at or above this lands in
+// slot 0 together with requests that failed to decode
+#define METRICS_MAX_OP 10
+// Threads spread over this many shards; with the epoll server every I/O
+// thread gets a shard of its own
+#define METRICS_SHARDS 16
+#define METRICS_DEFAULT_PATH "chat_metrics.txt"
+
+typedef enum MetricCounter {
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_SESSIONS_OPENED,
+    METRIC_SESSIONS_CLOSED,
+    METRIC_QUEUED_MESSAGES,
+    METRIC_QUEUED_BYTES,
+    METRIC_DEQUEUED_MESSAGES,
+    METRIC_DEQUEUED_BYTES,
+    METRIC_DROPPED_MESSAGES,
+    METRIC_EVICTIONS,
+    METRIC_HEARTBEAT_TIMEOUTS,
+    METRIC_OFFLINE_STORED,
+    METRIC_OFFLINE_DELIVERED,
+    METRIC_COUNTERS
+} MetricCounter;
+
+typedef enum MetricHistogram {
+    METRIC_FANOUT,      // recipients per broadcast
+    METRIC_QUEUE_DEPTH, // messages in a client's queue after each enqueue
+    METRIC_HISTOGRAMS
+} MetricHistogram;
+
+typedef struct AtomicHistogram {
+    _Atomic uint64_t counts[HISTOGRAM_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} AtomicHistogram;
+
+// Everything is a relaxed atomic add: a shard is usually written by one
+// thread, and the dump only needs each value to be untorn
+typedef struct MetricsShard {
+    _Atomic uint64_t counters[METRIC_COUNTERS];
+    _Atomic uint64_t requests[METRICS_MAX_OP];
+    _Atomic uint64_t errors[METRICS_MAX_OP];
+    AtomicHistogram latency[METRICS_MAX_OP]; // ns from frame to answer queued
+    AtomicHistogram histograms[METRIC_HISTOGRAMS];
+} MetricsShard;
+
+void metrics_add(MetricCounter counter, uint64_t value);
+void metrics_record(MetricHistogram histogram, uint64_t value);
+void metrics_request(int op, uint64_t latency_ns);
+void metrics_error(int op);
+uint64_t metrics_now(void);
+
+// Blocks SIGUSR1 in the calling thread and every thread it creates later,
+// then starts the thread that writes a snapshot to `path` on each SIGUSR1.
+// Call before any other thread exists.
+bool metrics_start(const char *path);
+bool metrics_dump(const char *path);
+
+#endif
@@ -0,0 +1,234 @@
+#include "presence.h"
+#include "chat.pb-c.h"
+#include "framing.h"
+#include "log.h"
+#include "shared_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void presence_record(Presence *presence, PresenceKind kind, const char *user_name, const char *user_ip, int32_t user_state) {
+    pthread_mutex_lock(&presence->mutex);
+    // Nobody listening: a later subscriber starts from a fresh snapshot
+    if (presence->subscriber_count == 0) {
+        pthread_mutex_unlock(&presence->mutex);
+        return;
+    }
+    if (presence->change_count == presence->change_capacity) {
+        size_t capacity = presence->change_capacity > 0 ? presence->change_capacity * 2 : 64;
+        PresenceChange *changes = (PresenceChange *)realloc(presence->changes, capacity * sizeof(PresenceChange));
+        if (changes == NULL) {
+            pthread_mutex_unlock(&presence->mutex);
+            log_error("Error al asignar memoria para los cambios de presencia: %m");
+            return;
+        }
+        presence->changes = changes;
+        presence->change_capacity = capacity;
+    }
+
+    PresenceChange *change = &presence->changes[presence->change_count++];
+    change->seq = presence->next_seq++;
+    change->kind = kind;
+    change->user_state = user_state;
+    snprintf(change->user_name, sizeof(change->user_name), "%s", user_name);
+    snprintf(change->user_ip, sizeof(change->user_ip), "%s", user_ip != NULL ? user_ip : "");
+    // The first change of a window starts it; the rest pile up behind it
+    if (presence->change_count == 1) {
+        timer_wheel_schedule(presence->wheel, &presence->flush_timer, PRESENCE_WINDOW_MS);
+    }
+    pthread_mutex_unlock(&presence->mutex);
+}
+
+void presence_joined(Presence *presence, const char *user_name, const char *user_ip, int32_t user_state) {
+    presence_record(presence, PRESENCE_JOIN, user_name, user_ip, user_state);
+}
+
+void presence_left(Presence *presence, const char *user_name) {
+    presence_record(presence, PRESENCE_LEAVE, user_name, NULL, USER_STATE_OFFLINE);
+}
+
+void presence_status(Presence *presence, const char *user_name, int32_t user_state) {
+    presence_record(presence, PRESENCE_STATUS, user_name, NULL, user_state);
+}
+
+bool presence_subscribe(Presence *presence, Session *session) {
+    pthread_mutex_lock(&presence->mutex);
+    if (session->presence_subscribed) {
+        pthread_mutex_unlock(&presence->mutex);
+        return true;
+    }
+    if (presence->subscriber_count == presence->subscriber_capacity) {
+        size_t capacity = presence->subscriber_capacity > 0 ? presence->subscriber_capacity * 2 : 64;
+        Session **subscribers = (Session **)realloc(presence->subscribers, capacity * sizeof(Session *));
+        if (subscribers == NULL) {
+            pthread_mutex_unlock(&presence->mutex);
+            return false;
+        }
+        presence->subscribers = subscribers;
+        presence->subscriber_capacity = capacity;
+    }
+    session_ref(session);
+    session->presence_subscribed = true;
+    session->presence_slot = presence->subscriber_count;
+    presence->subscribers[presence->subscriber_count++] = session;
+    pthread_mutex_unlock(&presence->mutex);
+
+    return true;
+}
+
+void presence_unsubscribe(Presence *presence, Session *session) {
+    pthread_mutex_lock(&presence->mutex);
+    if (!session->presence_subscribed) {
+        pthread_mutex_unlock(&presence->mutex);
+        return;
+    }
+    Session *last = presence->subscribers[--presence->subscriber_count];
+    presence->subscribers[session->presence_slot] = last;
+    last->presence_slot = session->presence_slot;
+    session->presence_subscribed = false;
+    pthread_mutex_unlock(&presence->mutex);
+
+    session_unref(session);
+}
+
+static int presence_compare(const void *a, const void *b) {
+    const PresenceChange *left = (const PresenceChange *)a;
+    const PresenceChange *right = (const PresenceChange *)b;
+    int order = strcmp(left->user_name, right->user_name);
+    if (order != 0) {
+        return order;
+    }
+    return left->seq < right->seq ? -1 : left->seq > right->seq;
+}
+
+// Folds one user's changes of the window into at most one delta: a user who
+// joined and left again within it never shows up, and only the last status
+// counts. Returns false when there is nothing to send.
+static bool presence_fold(const PresenceChange *first, const PresenceChange *last, ChatSistOS__Answer *answer,
+                          ChatSistOS__User *user, ChatSistOS__Status *status) {
+    answer->op = PRESENCE_OP;
+    answer->response_status_code = 200;
+
+    if (last->kind == PRESENCE_LEAVE && first->kind == PRESENCE_JOIN) {
+        return false;
+    }
+    if (last->kind == PRESENCE_JOIN || (last->kind == PRESENCE_STATUS && first->kind == PRESENCE_JOIN)) {
+        // A join carries the address; a status change right after it only
+        // updates the state the join reports
+        const PresenceChange *join = last;
+        while (join->kind != PRESENCE_JOIN) {
+            join--;
+        }
+        user->user_name = (char *)last->user_name;
+        user->user_ip = (char *)join->user_ip;
+        user->user_state = last->user_state;
+        answer->user = user;
+    } else {
+        status->user_name = (char *)last->user_name;
+        status->user_state = last->user_state;
+        answer->status = status;
+    }
+
+    return true;
+}
+
+// Serializes the folded deltas back to back, each in its own frame
+static SharedBuffer *presence_encode(PresenceChange *changes, size_t count, ChatSistOS__Answer *answers,
+                                     ChatSistOS__User *users, ChatSistOS__Status *statuses) {
+    size_t deltas = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < count;) {
+        size_t end = i + 1;
+        while (end < count && strcmp(changes[end].user_name, changes[i].user_name) == 0) {
+            end++;
+        }
+        chat_sist_os__answer__init(&answers[deltas]);
+        chat_sist_os__user__init(&users[deltas]);
+        chat_sist_os__status__init(&statuses[deltas]);
+        if (presence_fold(&changes[i], &changes[end - 1], &answers[deltas], &users[deltas], &statuses[deltas])) {
+            total += FRAME_HEADER_SIZE + chat_sist_os__answer__get_packed_size(&answers[deltas]);
+            deltas++;
+        }
+        i = end;
+    }
+    if (deltas == 0) {
+        return NULL;
+    }
+
+    SharedBuffer *buffer = shared_buffer_new(total);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    uint8_t *out = buffer->data;
+    for (size_t i = 0; i < deltas; i++) {
+        size_t len = chat_sist_os__answer__pack(&answers[i], out + FRAME_HEADER_SIZE);
+        frame_write_header(out, len);
+        out += FRAME_HEADER_SIZE + len;
+    }
+
+    return buffer;
+}
+
+// One buffer with the whole window, shared by every subscriber
+static SharedBuffer *presence_pack(PresenceChange *changes, size_t count) {
+    qsort(changes, count, sizeof(PresenceChange), presence_compare);
+
+    ChatSistOS__Answer *answers = (ChatSistOS__Answer *)malloc(count * sizeof(ChatSistOS__Answer));
+    ChatSistOS__User *users = (ChatSistOS__User *)malloc(count * sizeof(ChatSistOS__User));
+    ChatSistOS__Status *statuses = (ChatSistOS__Status *)malloc(count * sizeof(ChatSistOS__Status));
+    SharedBuffer *buffer = NULL;
+    if (answers != NULL && users != NULL && statuses != NULL) {
+        buffer = presence_encode(changes, count, answers, users, statuses);
+    }
+    free(answers);
+    free(users);
+    free(statuses);
+
+    return buffer;
+}
+
+static void presence_flush(Presence *presence) {
+    pthread_mutex_lock(&presence->mutex);
+    PresenceChange *changes = presence->changes;
+    size_t count = presence->change_count;
+    presence->changes = NULL;
+    presence->change_count = 0;
+    presence->change_capacity = 0;
+
+    // Take references under the lock, send with no lock held
+    size_t subscriber_count = presence->subscriber_count;
+    Session **subscribers = subscriber_count > 0 ? (Session **)malloc(subscriber_count * sizeof(Session *)) : NULL;
+    if (subscribers == NULL) {
+        subscriber_count = 0;
+    }
+    for (size_t i = 0; i < subscriber_count; i++) {
+        subscribers[i] = presence->subscribers[i];
+        session_ref(subscribers[i]);
+    }
+    pthread_mutex_unlock(&presence->mutex);
+
+    SharedBuffer *deltas = subscriber_count > 0 && count > 0 ? presence_pack(changes, count) : NULL;
+    for (size_t i = 0; i < subscriber_count; i++) {
+        if (deltas != NULL) {
+            session_enqueue(subscribers[i], deltas);
+        }
+        session_unref(subscribers[i]);
+    }
+    if (deltas != NULL) {
+        shared_buffer_unref(deltas);
+    }
+    free(subscribers);
+    free(changes);
+}
+
+static void presence_flush_fired(TimerEntry *entry) {
+    presence_flush((Presence *)((char *)entry - offsetof(Presence, flush_timer)));
+}
+
+bool presence_init(Presence *presence, TimerWheel *wheel) {
+    memset(presence, 0, sizeof(*presence));
+    presence->wheel = wheel;
+    timer_entry_init(&presence->flush_timer, presence_flush_fired);
+
+    return pthread_mutex_init(&presence->mutex, NULL) == 0;
+}
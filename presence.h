@@ -0,0 +1,60 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "registry.h"
+#include "session.h"
+#include "timer_wheel.h"
+
+// Answer.op of a presence delta: Answer.user for a join, Answer.status for
+// a leave (state USER_STATE_OFFLINE) or a status change
+#define PRESENCE_OP 5
+#define PRESENCE_WINDOW_MS 200
+
+typedef enum PresenceKind {
+    PRESENCE_JOIN,
+    PRESENCE_LEAVE,
+    PRESENCE_STATUS
+} PresenceKind;
+
+typedef struct PresenceChange {
+    uint64_t seq;
+    PresenceKind kind;
+    int32_t user_state;
+    char user_name[USER_NAME_MAX + 1];
+    char user_ip[INET_ADDRSTRLEN];
+} PresenceChange;
+
+// Sessions that asked for a user list once and now only want to hear what
+// changed. Changes are collected for PRESENCE_WINDOW_MS, folded to at most
+// one delta per user, and every subscriber gets the same buffer. The first
+// change of a window arms flush_timer; the flush runs on the wheel's thread.
+typedef struct Presence {
+    pthread_mutex_t mutex;
+    TimerWheel *wheel;
+    TimerEntry flush_timer;
+
+    PresenceChange *changes;
+    size_t change_count;
+    size_t change_capacity;
+    uint64_t next_seq;
+
+    Session **subscribers;
+    size_t subscriber_count;
+    size_t subscriber_capacity;
+} Presence;
+
+bool presence_init(Presence *presence, TimerWheel *wheel);
+void presence_joined(Presence *presence, const char *user_name, const char *user_ip, int32_t user_state);
+void presence_left(Presence *presence, const char *user_name);
+void presence_status(Presence *presence, const char *user_name, int32_t user_state);
+// Deltas may repeat what a snapshot taken after subscribing already shows;
+// applying them again is harmless
+bool presence_subscribe(Presence *presence, Session *session);
+void presence_unsubscribe(Presence *presence, Session *session);
+
+#endif
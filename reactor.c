@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+#include "reactor.h"
+#include "log.h"
+#include "workpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define REACTOR_MAX_EVENTS 256
+
+// The loop the calling thread runs, if any
+static __thread ReactorLoop *current_loop = NULL;
+
+// The epoll loops serving clients, for broadcasts; none in threaded mode
+static ReactorLoop *reactor_loops = NULL;
+static int reactor_loop_count = 0;
+// Where requests are handled when the loops should only do I/O
+static WorkPool *reactor_pool = NULL;
+
+void reactor_set_pool(WorkPool *pool) {
+    reactor_pool = pool;
+}
+
+static void reactor_add_member(ReactorLoop *loop, Session *session) {
+    if (loop->member_count == loop->member_capacity) {
+        size_t capacity = loop->member_capacity > 0 ? loop->member_capacity * 2 : 256;
+        Session **members = (Session **)realloc(loop->members, capacity * sizeof(Session *));
+        if (members == NULL) {
+            // Still served, only left out of broadcasts
+            log_error("Error al asignar memoria para las sesiones del hilo de E/S: %m");
+            return;
+        }
+        loop->members = members;
+        loop->member_capacity = capacity;
+    }
+    session->loop_slot = loop->member_count;
+    loop->members[loop->member_count++] = session;
+}
+
+static void reactor_remove_member(ReactorLoop *loop, Session *session) {
+    size_t slot = session->loop_slot;
+    if (slot >= loop->member_count || loop->members[slot] != session) {
+        return;
+    }
+    Session *last = loop->members[--loop->member_count];
+    loop->members[slot] = last;
+    last->loop_slot = slot;
+}
+
+static void reactor_close_session(ReactorLoop *loop, Session *session) {
+    if (session->state == SESSION_CLOSING) {
+        return;
+    }
+
+    if (reactor_pool != NULL) {
+        workpool_close(reactor_pool, session);
+    } else {
+        loop->on_close(session);
+    }
+    reactor_remove_member(loop, session);
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, session->client_socket, NULL);
+    session_close_socket(session);
+    session_unref(session);
+}
+
+static void reactor_read_session(ReactorLoop *loop, Session *session) {
+    // Edge-triggered: drain the socket until it would block, handing every
+    // complete frame of each recv to the request handler, or to the pool in
+    // one batch. Replies made here go out together once the socket is
+    // drained; a pool worker corks its own turn.
+    bool direct = reactor_pool == NULL;
+    if (direct) {
+        session_cork(session);
+    }
+    while (session->state == SESSION_OPEN) {
+        ssize_t len = frame_buffer_recv(&session->in_frames, session->client_socket);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                frame_buffer_release(&session->in_frames);
+                if (direct && !session_uncork(session)) {
+                    reactor_close_session(loop, session);
+                }
+                return;
+            }
+            reactor_close_session(loop, session);
+            return;
+        }
+        if (len == 0) {
+            reactor_close_session(loop, session);
+            return;
+        }
+
+        const uint8_t *payload;
+        size_t payload_len;
+        size_t first = session->in_frames.start;
+        int status;
+        while ((status = frame_buffer_next(&session->in_frames, &payload, &payload_len)) > 0) {
+            if (direct) {
+                loop->on_request(session, payload, payload_len);
+            }
+        }
+        if (!direct && session->in_frames.start > first &&
+            !workpool_submit(reactor_pool, session, session->in_frames.data + first, session->in_frames.start - first)) {
+            log_error("Error al asignar memoria para las peticiones del cliente: %m");
+            reactor_close_session(loop, session);
+            return;
+        }
+        if (status < 0) {
+            log_warn("Trama demasiado grande, cerrando la conexión");
+            reactor_close_session(loop, session);
+            return;
+        }
+    }
+}
+
+static bool reactor_push_task(ReactorLoop *loop, ReactorTaskKind kind, Session *session, SharedBuffer *buffer) {
+    bool wake;
+
+    pthread_mutex_lock(&loop->task_mutex);
+    if (loop->task_count == loop->task_capacity) {
+        size_t capacity = loop->task_capacity > 0 ? loop->task_capacity * 2 : 64;
+        ReactorTask *tasks = (ReactorTask *)realloc(loop->tasks, capacity * sizeof(ReactorTask));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&loop->task_mutex);
+            return false;
+        }
+        loop->tasks = tasks;
+        loop->task_capacity = capacity;
+    }
+    if (session != NULL) {
+        session_ref(session);
+    }
+    if (buffer != NULL) {
+        shared_buffer_ref(buffer);
+    }
+    ReactorTask *task = &loop->tasks[loop->task_count];
+    task->kind = kind;
+    task->session = session;
+    task->buffer = buffer;
+    wake = loop->task_count++ == 0;
+    pthread_mutex_unlock(&loop->task_mutex);
+
+    // The loop drains its tasks after every epoll batch, so it only needs a
+    // wake-up when another thread queued the first one
+    if (wake && current_loop != loop) {
+        uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            log_error("Error al despertar el hilo de E/S: %m");
+        }
+    }
+
+    return true;
+}
+
+// Called by session_enqueue when a session's queue needs writing
+void reactor_schedule_flush(ReactorLoop *loop, Session *session) {
+    if (!reactor_push_task(loop, REACTOR_FLUSH, session, NULL)) {
+        log_error("Error al programar el envío al cliente: %m");
+    }
+}
+
+bool reactor_broadcast(SharedBuffer *delivery) {
+    if (reactor_loop_count == 0 || reactor_pool != NULL) {
+        return false;
+    }
+    for (int i = 0; i < reactor_loop_count; i++) {
+        if (!reactor_push_task(&reactor_loops[i], REACTOR_BROADCAST, NULL, delivery)) {
+            log_error("Error al repartir el mensaje al hilo de E/S %d: %m", i);
+        }
+    }
+    return true;
+}
+
+// Registered once for both directions; edge-triggered so idle sockets cost
+// nothing after the first notification
+static void reactor_serve(ReactorLoop *loop, Session *session) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = session;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, session->client_socket, &event) < 0) {
+        log_error("Error al registrar el socket del cliente en epoll: %m");
+        session_close_socket(session);
+        session_unref(session);
+        return;
+    }
+    reactor_add_member(loop, session);
+}
+
+static void reactor_fan_out(ReactorLoop *loop, SharedBuffer *delivery) {
+    for (size_t i = 0; i < loop->member_count; i++) {
+        Session *member = loop->members[i];
+        if (member->user_handle != USER_HANDLE_NONE) {
+            session_enqueue(member, delivery);
+        }
+    }
+}
+
+static void reactor_run_task(ReactorLoop *loop, ReactorTask *task) {
+    Session *session = task->session;
+    switch (task->kind) {
+    case REACTOR_FLUSH:
+        if (!session_flush(session) && !session->threaded) {
+            reactor_close_session(loop, session);
+        }
+        break;
+    case REACTOR_ATTACH:
+        // The task's reference becomes the loop's
+        session_ref(session);
+        reactor_serve(loop, session);
+        break;
+    case REACTOR_DETACH:
+        // Drops the reference taken by reactor_attach
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, session->client_socket, NULL);
+        session_close_socket(session);
+        session_unref(session);
+        break;
+    case REACTOR_BROADCAST:
+        reactor_fan_out(loop, task->buffer);
+        break;
+    }
+    if (session != NULL) {
+        session_unref(session);
+    }
+    if (task->buffer != NULL) {
+        shared_buffer_unref(task->buffer);
+    }
+}
+
+// Tasks may queue more tasks (a broadcast schedules flushes), so drain
+// until none are left rather than leave them for after the next epoll_wait
+static void reactor_run_tasks(ReactorLoop *loop) {
+    while (1) {
+        pthread_mutex_lock(&loop->task_mutex);
+        ReactorTask *tasks = loop->tasks;
+        size_t count = loop->task_count;
+        size_t capacity = loop->task_capacity;
+        loop->tasks = loop->spare_tasks;
+        loop->task_capacity = loop->spare_capacity;
+        loop->task_count = 0;
+        pthread_mutex_unlock(&loop->task_mutex);
+
+        for (size_t i = 0; i < count; i++) {
+            reactor_run_task(loop, &tasks[i]);
+        }
+        loop->spare_tasks = tasks;
+        loop->spare_capacity = capacity;
+        if (count == 0) {
+            return;
+        }
+    }
+}
+
+static void reactor_accept(ReactorLoop *loop, int listen_fd);
+
+static void *reactor_loop_thread(void *loop_ptr) {
+    ReactorLoop *loop = (ReactorLoop *)loop_ptr;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    current_loop = loop;
+    while (1) {
+        int n = epoll_wait(loop->epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Error en epoll_wait: %m");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            Session *session = (Session *)events[i].data.ptr;
+            uint32_t ev = events[i].events;
+
+            if (events[i].data.ptr == &loop->listen_fd) {
+                reactor_accept(loop, loop->listen_fd);
+                continue;
+            }
+            if (session == NULL) {
+                uint64_t wakeups;
+                if (read(loop->wake_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN) {
+                    log_error("Error al leer el eventfd del hilo de E/S: %m");
+                }
+                continue;
+            }
+            if (session->threaded) {
+                // Its reader thread notices errors and hang-ups on its own
+                if (ev & EPOLLOUT) {
+                    session_flush(session);
+                }
+                continue;
+            }
+            if (ev & (EPOLLERR | EPOLLHUP)) {
+                reactor_close_session(loop, session);
+                continue;
+            }
+            if ((ev & EPOLLOUT) && !session_flush(session)) {
+                reactor_close_session(loop, session);
+                continue;
+            }
+            if (ev & (EPOLLIN | EPOLLRDHUP)) {
+                reactor_read_session(loop, session);
+            }
+        }
+
+        // Output queued while handling this batch, or by other threads
+        reactor_run_tasks(loop);
+    }
+
+    return NULL;
+}
+
+static bool reactor_start_loop(ReactorLoop *loop, ReactorRequestHandler on_request, ReactorCloseHandler on_close) {
+    loop->on_request = on_request;
+    loop->on_close = on_close;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        perror("Error al crear la instancia de epoll");
+        return false;
+    }
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_fd < 0) {
+        perror("Error al crear el eventfd del hilo de E/S");
+        return false;
+    }
+    if (pthread_mutex_init(&loop->task_mutex, NULL) != 0) {
+        perror("Error al inicializar el mutex del hilo de E/S");
+        return false;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) < 0) {
+        perror("Error al registrar el eventfd en epoll");
+        return false;
+    }
+    if (loop->listen_fd >= 0) {
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = &loop->listen_fd;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &event) < 0) {
+            perror("Error al registrar el socket de escucha en epoll");
+            return false;
+        }
+    }
+    if (pthread_create(&loop->thread_id, NULL, reactor_loop_thread, loop) != 0) {
+        perror("Error al crear el hilo de E/S");
+        return false;
+    }
+
+    return true;
+}
+
+ReactorLoop *reactor_start_writer(void) {
+    ReactorLoop *loop = (ReactorLoop *)calloc(1, sizeof(ReactorLoop));
+    if (loop == NULL) {
+        return NULL;
+    }
+    loop->listen_fd = -1;
+    if (!reactor_start_loop(loop, NULL, NULL)) {
+        free(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+// Registers a threaded session for write readiness only. The registration
+// holds a reference that reactor_detach gives back.
+bool reactor_attach(ReactorLoop *loop, Session *session) {
+    struct epoll_event event;
+    event.events = EPOLLOUT | EPOLLET;
+    event.data.ptr = session;
+
+    session->threaded = true;
+    session->loop = loop;
+    session_ref(session);
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, session->client_socket, &event) < 0) {
+        session_unref(session);
+        return false;
+    }
+
+    return true;
+}
+
+// The loop, not the caller, removes the descriptor and closes it, so an
+// event already in flight for the session never outlives it
+void reactor_detach(ReactorLoop *loop, Session *session) {
+    while (!reactor_push_task(loop, REACTOR_DETACH, session, NULL)) {
+        usleep(1000);
+    }
+}
+
+// Idle connections are cheap in this mode, so the descriptor limit is
+// usually what caps the number of clients
+static void reactor_raise_fd_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+            perror("Error al aumentar el límite de descriptores");
+        }
+    }
+}
+
+static Session *reactor_new_session(int client_socket, struct sockaddr_in *client_addr) {
+    log_info("Cliente conectado desde %s:%d", inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
+
+    int one = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    Session *session = session_create(client_socket, client_addr);
+    if (session == NULL) {
+        log_error("Error al asignar memoria para la sesión del cliente: %m");
+        close(client_socket);
+    }
+    return session;
+}
+
+// Edge-triggered listener: take every pending connection
+static void reactor_accept(ReactorLoop *loop, int listen_fd) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_size = sizeof(client_addr);
+        int client_socket = accept4(listen_fd, (struct sockaddr *)&client_addr, &addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error("Error al aceptar conexión del cliente: %m");
+            }
+            return;
+        }
+
+        Session *session = reactor_new_session(client_socket, &client_addr);
+        if (session != NULL) {
+            session->loop = loop;
+            reactor_serve(loop, session);
+        }
+    }
+}
+
+static ReactorLoop *reactor_create_loops(int io_threads) {
+    reactor_loops = (ReactorLoop *)calloc((size_t)io_threads, sizeof(ReactorLoop));
+    if (reactor_loops == NULL) {
+        perror("Error al asignar memoria para los hilos de E/S");
+        return NULL;
+    }
+    for (int i = 0; i < io_threads; i++) {
+        reactor_loops[i].listen_fd = -1;
+    }
+    reactor_raise_fd_limit();
+
+    return reactor_loops;
+}
+
+int reactor_run(int server_socket, int io_threads, ReactorRequestHandler on_request, ReactorCloseHandler on_close) {
+    ReactorLoop *loops = reactor_create_loops(io_threads);
+    if (loops == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < io_threads; i++) {
+        if (!reactor_start_loop(&loops[i], on_request, on_close)) {
+            return -1;
+        }
+    }
+    reactor_loop_count = io_threads;
+
+    log_info("Reactor epoll con %d hilo(s) de E/S", io_threads);
+
+    int next_loop = 0;
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_size = sizeof(client_addr);
+        int client_socket = accept4(server_socket, (struct sockaddr *)&client_addr, &addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client_socket < 0) {
+            if (errno != EINTR) {
+                log_error("Error al aceptar conexión del cliente: %m");
+            }
+            continue;
+        }
+
+        Session *session = reactor_new_session(client_socket, &client_addr);
+        if (session == NULL) {
+            continue;
+        }
+
+        // The loop registers it itself, so its member list stays loop-only
+        ReactorLoop *loop = &loops[next_loop];
+        next_loop = (next_loop + 1) % io_threads;
+        session->loop = loop;
+        while (!reactor_push_task(loop, REACTOR_ATTACH, session, NULL)) {
+            usleep(1000);
+        }
+        session_unref(session);
+    }
+
+    return 0;
+}
+
+static int reactor_listen_reuseport(int port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("Error al crear el socket del servidor");
+        return -1;
+    }
+
+    int one = 1;
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("Error al activar SO_REUSEPORT");
+        close(listen_fd);
+        return -1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Error al enlazar el socket del servidor");
+        close(listen_fd);
+        return -1;
+    }
+    if (listen(listen_fd, SOMAXCONN) < 0) {
+        perror("Error al escuchar en el socket del servidor");
+        close(listen_fd);
+        return -1;
+    }
+
+    return listen_fd;
+}
+
+int reactor_run_reuseport(int port, int io_threads, ReactorRequestHandler on_request, ReactorCloseHandler on_close) {
+    ReactorLoop *loops = reactor_create_loops(io_threads);
+    if (loops == NULL) {
+        return -1;
+    }
+
+    // All listeners exist before any loop runs, so reactor_loop_count is
+    // final by the time a broadcast can be sent
+    for (int i = 0; i < io_threads; i++) {
+        loops[i].listen_fd = reactor_listen_reuseport(port);
+        if (loops[i].listen_fd < 0) {
+            return -1;
+        }
+    }
+    reactor_loop_count = io_threads;
+    for (int i = 0; i < io_threads; i++) {
+        if (!reactor_start_loop(&loops[i], on_request, on_close)) {
+            return -1;
+        }
+    }
+
+    log_info("Reactor epoll con %d hilo(s) de E/S, cada uno con su socket SO_REUSEPORT", io_threads);
+
+    for (int i = 0; i < io_threads; i++) {
+        pthread_join(loops[i].thread_id, NULL);
+    }
+
+    return 0;
+}
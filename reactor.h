@@ -0,0 +1,75 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "session.h"
+#include "shared_buffer.h"
+#include <pthread.h>
+
+// Called on an I/O thread for every complete frame a session receives
+typedef void (*ReactorRequestHandler)(Session *session, const uint8_t *data, size_t len);
+// Called on an I/O thread right before a session is closed and freed
+typedef void (*ReactorCloseHandler)(Session *session);
+
+struct WorkPool;
+
+typedef enum ReactorTaskKind {
+    REACTOR_FLUSH,     // write the session's queue
+    REACTOR_ATTACH,    // start serving a session accepted on another thread
+    REACTOR_DETACH,    // threaded mode: the reader thread is done with it
+    REACTOR_BROADCAST  // queue the buffer on every registered local session
+} ReactorTaskKind;
+
+// Work other threads hand to a loop; holds a reference to whatever it names
+typedef struct ReactorTask {
+    ReactorTaskKind kind;
+    Session *session;
+    SharedBuffer *buffer;
+} ReactorTask;
+
+typedef struct ReactorLoop {
+    int epoll_fd;
+    int wake_fd;   // eventfd other threads poke after queuing tasks
+    int listen_fd; // own SO_REUSEPORT listener, or -1
+    pthread_t thread_id;
+    ReactorRequestHandler on_request;
+    ReactorCloseHandler on_close;
+
+    pthread_mutex_t task_mutex;
+    ReactorTask *tasks;
+    size_t task_count;
+    size_t task_capacity;
+    ReactorTask *spare_tasks; // swapped with tasks on every drain
+    size_t spare_capacity;
+
+    // The loop's shard of the clients: every session it serves, so a
+    // broadcast is one task per loop instead of one per recipient.
+    // Loop thread only.
+    Session **members;
+    size_t member_count;
+    size_t member_capacity;
+} ReactorLoop;
+
+// Accepts connections on server_socket forever, multiplexing every client on
+// io_threads edge-triggered epoll loops. Only returns on a setup error.
+int reactor_run(int server_socket, int io_threads, ReactorRequestHandler on_request, ReactorCloseHandler on_close);
+// Same, but every loop binds its own SO_REUSEPORT listener on `port` and
+// accepts for itself, so the kernel spreads connections over the loops
+int reactor_run_reuseport(int port, int io_threads, ReactorRequestHandler on_request, ReactorCloseHandler on_close);
+
+// Set before reactor_run: the loops then only read and split frames and
+// hand them to the pool, which runs the request and close handlers
+void reactor_set_pool(struct WorkPool *pool);
+
+// Threaded mode: one loop that only writes, draining the output of sessions
+// whose requests are read on their own threads
+ReactorLoop *reactor_start_writer(void);
+bool reactor_attach(ReactorLoop *loop, Session *session);
+void reactor_detach(ReactorLoop *loop, Session *session);
+
+void reactor_schedule_flush(ReactorLoop *loop, Session *session);
+// Hands the delivery to every loop, which queues it on its own registered
+// sessions. False when no epoll loops are running (threaded mode) or a
+// worker pool does the fan-out instead.
+bool reactor_broadcast(SharedBuffer *delivery);
+
+#endif
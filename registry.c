@@ -0,0 +1,431 @@
+#include "registry.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define REGISTRY_INITIAL_BUCKETS 64
+#define REGISTRY_SLOT_BITS (32 - REGISTRY_SHARD_BITS)
+#define REGISTRY_MAX_SLOTS (1u << REGISTRY_SLOT_BITS)
+
+// FNV-1a, folded to 32 bits
+static uint32_t registry_hash(const char *user_name, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)user_name[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// The low hash bits pick the bucket inside a shard, the high ones the shard
+static RegistryShard *registry_shard_for(Registry *registry, uint32_t hash) {
+    return &registry->shards[hash >> (32 - REGISTRY_SHARD_BITS)];
+}
+
+static ConnectedUser *registry_slot(RegistryShard *shard, uint32_t slot) {
+    return &shard->chunks[slot / REGISTRY_CHUNK_SIZE][slot % REGISTRY_CHUNK_SIZE];
+}
+
+static UserHandle registry_make_handle(Registry *registry, RegistryShard *shard, uint32_t slot, uint32_t generation) {
+    uint32_t shard_index = (uint32_t)(shard - registry->shards);
+    return ((UserHandle)generation << 32) | ((UserHandle)shard_index << REGISTRY_SLOT_BITS) | slot;
+}
+
+static bool registry_shard_init(RegistryShard *shard) {
+    memset(shard, 0, sizeof(RegistryShard));
+    shard->buckets = (RegistryBucket *)calloc(REGISTRY_INITIAL_BUCKETS, sizeof(RegistryBucket));
+    if (shard->buckets == NULL) {
+        return false;
+    }
+    shard->bucket_mask = REGISTRY_INITIAL_BUCKETS - 1;
+
+    return pthread_rwlock_init(&shard->lock, NULL) == 0;
+}
+
+static void registry_shard_destroy(RegistryShard *shard) {
+    for (size_t i = 0; i < shard->chunk_count; i++) {
+        free(shard->chunks[i]);
+    }
+    free(shard->chunks);
+    free(shard->free_slots);
+    free(shard->buckets);
+    free(shard->dense);
+    pthread_rwlock_destroy(&shard->lock);
+}
+
+bool registry_init(Registry *registry) {
+    memset(registry, 0, sizeof(Registry));
+    for (size_t i = 0; i < REGISTRY_SHARDS; i++) {
+        if (!registry_shard_init(&registry->shards[i])) {
+            return false;
+        }
+    }
+    atomic_init(&registry->count, 0);
+    atomic_init(&registry->version, 1);
+
+    return pthread_rwlock_init(&registry->socket_lock, NULL) == 0;
+}
+
+void registry_destroy(Registry *registry) {
+    for (size_t i = 0; i < REGISTRY_SHARDS; i++) {
+        registry_shard_destroy(&registry->shards[i]);
+    }
+    pthread_rwlock_destroy(&registry->socket_lock);
+    free(registry->by_socket);
+}
+
+// Takes a free slot, adding a chunk when every slot is in use. Generations
+// start at 1 so no live handle ever equals USER_HANDLE_NONE.
+static bool registry_alloc_slot(RegistryShard *shard, uint32_t *slot) {
+    if (shard->free_count > 0) {
+        *slot = shard->free_slots[--shard->free_count];
+        return true;
+    }
+
+    if (shard->slot_count == shard->chunk_count * REGISTRY_CHUNK_SIZE) {
+        if (shard->slot_count + REGISTRY_CHUNK_SIZE > REGISTRY_MAX_SLOTS) {
+            return false;
+        }
+        ConnectedUser **chunks = (ConnectedUser **)realloc(shard->chunks, (shard->chunk_count + 1) * sizeof(ConnectedUser *));
+        if (chunks == NULL) {
+            return false;
+        }
+        shard->chunks = chunks;
+
+        uint32_t *free_slots = (uint32_t *)realloc(shard->free_slots, (shard->chunk_count + 1) * REGISTRY_CHUNK_SIZE * sizeof(uint32_t));
+        if (free_slots == NULL) {
+            return false;
+        }
+        shard->free_slots = free_slots;
+
+        ConnectedUser *chunk = (ConnectedUser *)calloc(REGISTRY_CHUNK_SIZE, sizeof(ConnectedUser));
+        if (chunk == NULL) {
+            return false;
+        }
+        for (size_t i = 0; i < REGISTRY_CHUNK_SIZE; i++) {
+            chunk[i].generation = 1;
+        }
+        shard->chunks[shard->chunk_count++] = chunk;
+    }
+
+    *slot = (uint32_t)shard->slot_count++;
+    return true;
+}
+
+static void registry_bucket_insert(RegistryBucket *buckets, size_t mask, uint32_t hash, uint32_t slot) {
+    size_t i = hash & mask;
+    while (buckets[i].slot_plus_one != 0) {
+        i = (i + 1) & mask;
+    }
+    buckets[i].hash = hash;
+    buckets[i].slot_plus_one = slot + 1;
+}
+
+// Keeps the load factor under 70% so probe sequences stay short
+static bool registry_grow_buckets(RegistryShard *shard) {
+    size_t capacity = shard->bucket_mask + 1;
+    if ((shard->count + 1) * 10 < capacity * 7) {
+        return true;
+    }
+
+    size_t new_capacity = capacity * 2;
+    RegistryBucket *buckets = (RegistryBucket *)calloc(new_capacity, sizeof(RegistryBucket));
+    if (buckets == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        if (shard->buckets[i].slot_plus_one != 0) {
+            registry_bucket_insert(buckets, new_capacity - 1, shard->buckets[i].hash, shard->buckets[i].slot_plus_one - 1);
+        }
+    }
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucket_mask = new_capacity - 1;
+
+    return true;
+}
+
+static bool registry_grow_dense(RegistryShard *shard) {
+    if (shard->count < shard->dense_capacity) {
+        return true;
+    }
+
+    size_t capacity = shard->dense_capacity > 0 ? shard->dense_capacity * 2 : REGISTRY_CHUNK_SIZE;
+    uint32_t *dense = (uint32_t *)realloc(shard->dense, capacity * sizeof(uint32_t));
+    if (dense == NULL) {
+        return false;
+    }
+    shard->dense = dense;
+    shard->dense_capacity = capacity;
+
+    return true;
+}
+
+static bool registry_set_socket(Registry *registry, int client_socket, UserHandle handle) {
+    bool ok = true;
+
+    pthread_rwlock_wrlock(&registry->socket_lock);
+    if ((size_t)client_socket >= registry->by_socket_size) {
+        size_t size = registry->by_socket_size > 0 ? registry->by_socket_size : REGISTRY_CHUNK_SIZE;
+        while (size <= (size_t)client_socket) {
+            size *= 2;
+        }
+        UserHandle *by_socket = (UserHandle *)realloc(registry->by_socket, size * sizeof(UserHandle));
+        if (by_socket == NULL) {
+            ok = false;
+        } else {
+            memset(by_socket + registry->by_socket_size, 0, (size - registry->by_socket_size) * sizeof(UserHandle));
+            registry->by_socket = by_socket;
+            registry->by_socket_size = size;
+        }
+    }
+    if (ok) {
+        registry->by_socket[client_socket] = handle;
+    }
+    pthread_rwlock_unlock(&registry->socket_lock);
+
+    return ok;
+}
+
+static void registry_clear_socket(Registry *registry, int client_socket, UserHandle handle) {
+    pthread_rwlock_wrlock(&registry->socket_lock);
+    if ((size_t)client_socket < registry->by_socket_size && registry->by_socket[client_socket] == handle) {
+        registry->by_socket[client_socket] = USER_HANDLE_NONE;
+    }
+    pthread_rwlock_unlock(&registry->socket_lock);
+}
+
+// Index of the bucket holding user_name, or of the empty bucket ending its
+// probe sequence
+static size_t registry_probe(RegistryShard *shard, const char *user_name, uint32_t hash) {
+    size_t i = hash & shard->bucket_mask;
+    while (shard->buckets[i].slot_plus_one != 0) {
+        if (shard->buckets[i].hash == hash &&
+            strcmp(registry_slot(shard, shard->buckets[i].slot_plus_one - 1)->user_name, user_name) == 0) {
+            return i;
+        }
+        i = (i + 1) & shard->bucket_mask;
+    }
+
+    return i;
+}
+
+// Backward-shift deletion: pulls later members of the probe run into the
+// hole so lookups never need tombstones
+static void registry_bucket_remove(RegistryShard *shard, size_t hole) {
+    size_t mask = shard->bucket_mask;
+    size_t i = hole;
+
+    while (1) {
+        i = (i + 1) & mask;
+        if (shard->buckets[i].slot_plus_one == 0) {
+            break;
+        }
+        size_t home = shard->buckets[i].hash & mask;
+        // Move the entry back only if its home is not inside (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            shard->buckets[hole] = shard->buckets[i];
+            hole = i;
+        }
+    }
+    shard->buckets[hole].slot_plus_one = 0;
+}
+
+static void registry_shard_remove(RegistryShard *shard, ConnectedUser *user) {
+    registry_bucket_remove(shard, registry_probe(shard, user->user_name, user->name_hash));
+
+    uint32_t last_slot = shard->dense[--shard->count];
+    shard->dense[user->dense_index] = last_slot;
+    registry_slot(shard, last_slot)->dense_index = user->dense_index;
+
+    user->generation++;
+    if (user->generation == 0) {
+        user->generation = 1;
+    }
+    user->session = NULL;
+    shard->free_slots[shard->free_count++] = user->slot;
+}
+
+RegistryStatus registry_add(Registry *registry, const char *user_name, int32_t user_state, struct Session *session,
+                            int client_socket, const struct sockaddr_in *client_addr, UserHandle *handle) {
+    size_t len = strlen(user_name);
+    if (len == 0 || len > USER_NAME_MAX) {
+        return REGISTRY_INVALID_NAME;
+    }
+
+    uint32_t hash = registry_hash(user_name, len);
+    RegistryShard *shard = registry_shard_for(registry, hash);
+    uint32_t slot;
+
+    pthread_rwlock_wrlock(&shard->lock);
+    if (shard->buckets[registry_probe(shard, user_name, hash)].slot_plus_one != 0) {
+        pthread_rwlock_unlock(&shard->lock);
+        return REGISTRY_EXISTS;
+    }
+    if (!registry_grow_buckets(shard) || !registry_grow_dense(shard) || !registry_alloc_slot(shard, &slot)) {
+        pthread_rwlock_unlock(&shard->lock);
+        return REGISTRY_NO_MEMORY;
+    }
+
+    ConnectedUser *user = registry_slot(shard, slot);
+    memcpy(user->user_name, user_name, len + 1);
+    atomic_store(&user->user_state, user_state);
+    user->session = session;
+    user->client_socket = client_socket;
+    user->user_ip[0] = '\0';
+    user->user_port = 0;
+    if (client_addr != NULL) {
+        inet_ntop(AF_INET, &client_addr->sin_addr, user->user_ip, INET_ADDRSTRLEN);
+        user->user_port = ntohs(client_addr->sin_port);
+    }
+    user->name_hash = hash;
+    user->slot = slot;
+    user->dense_index = (uint32_t)shard->count;
+
+    shard->dense[shard->count++] = slot;
+    registry_bucket_insert(shard->buckets, shard->bucket_mask, hash, slot);
+    *handle = registry_make_handle(registry, shard, slot, user->generation);
+
+    if (client_socket >= 0 && !registry_set_socket(registry, client_socket, *handle)) {
+        registry_shard_remove(shard, user);
+        pthread_rwlock_unlock(&shard->lock);
+        return REGISTRY_NO_MEMORY;
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    atomic_fetch_add(&registry->count, 1);
+    atomic_fetch_add(&registry->version, 1);
+
+    return REGISTRY_OK;
+}
+
+// Resolves a handle inside its (already locked) shard
+static ConnectedUser *registry_resolve(Registry *registry, UserHandle handle, RegistryShard **shard) {
+    uint32_t slot = (uint32_t)handle & (REGISTRY_MAX_SLOTS - 1);
+    uint32_t generation = (uint32_t)(handle >> 32);
+    *shard = &registry->shards[((uint32_t)handle) >> REGISTRY_SLOT_BITS];
+    if (handle == USER_HANDLE_NONE || slot >= (*shard)->slot_count) {
+        return NULL;
+    }
+
+    ConnectedUser *user = registry_slot(*shard, slot);
+    return user->generation == generation ? user : NULL;
+}
+
+bool registry_remove(Registry *registry, UserHandle handle) {
+    RegistryShard *shard = &registry->shards[((uint32_t)handle) >> REGISTRY_SLOT_BITS];
+
+    pthread_rwlock_wrlock(&shard->lock);
+    ConnectedUser *user = registry_resolve(registry, handle, &shard);
+    if (user == NULL) {
+        pthread_rwlock_unlock(&shard->lock);
+        return false;
+    }
+    int client_socket = user->client_socket;
+    registry_shard_remove(shard, user);
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (client_socket >= 0) {
+        registry_clear_socket(registry, client_socket, handle);
+    }
+    atomic_fetch_sub(&registry->count, 1);
+    atomic_fetch_add(&registry->version, 1);
+
+    return true;
+}
+
+bool registry_get(Registry *registry, UserHandle handle, RegistryVisitor visit, void *context) {
+    RegistryShard *shard = &registry->shards[((uint32_t)handle) >> REGISTRY_SLOT_BITS];
+
+    pthread_rwlock_rdlock(&shard->lock);
+    ConnectedUser *user = registry_resolve(registry, handle, &shard);
+    if (user != NULL && visit != NULL) {
+        visit(user, context);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    return user != NULL;
+}
+
+// Presence changes are the most frequent write, so they only take the
+// user's shard read lock and swap the state atomically. `expected` < 0
+// accepts any current state. Copies the name out (USER_NAME_MAX + 1 bytes)
+// when user_name is not NULL. Returns true if the state changed.
+bool registry_set_state(Registry *registry, UserHandle handle, int32_t expected, int32_t user_state, char *user_name) {
+    RegistryShard *shard = &registry->shards[((uint32_t)handle) >> REGISTRY_SLOT_BITS];
+    bool changed = false;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    ConnectedUser *user = registry_resolve(registry, handle, &shard);
+    if (user != NULL) {
+        int32_t current = atomic_load(&user->user_state);
+        while (current != user_state && (expected < 0 || current == expected)) {
+            if (atomic_compare_exchange_weak(&user->user_state, &current, user_state)) {
+                changed = true;
+                break;
+            }
+        }
+        if (changed && user_name != NULL) {
+            memcpy(user_name, user->user_name, sizeof(user->user_name));
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (changed) {
+        atomic_fetch_add(&registry->version, 1);
+    }
+
+    return changed;
+}
+
+bool registry_find_by_name(Registry *registry, const char *user_name, RegistryVisitor visit, void *context) {
+    uint32_t hash = registry_hash(user_name, strlen(user_name));
+    RegistryShard *shard = registry_shard_for(registry, hash);
+    ConnectedUser *user = NULL;
+
+    pthread_rwlock_rdlock(&shard->lock);
+    RegistryBucket *bucket = &shard->buckets[registry_probe(shard, user_name, hash)];
+    if (bucket->slot_plus_one != 0) {
+        user = registry_slot(shard, bucket->slot_plus_one - 1);
+        if (visit != NULL) {
+            visit(user, context);
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    return user != NULL;
+}
+
+bool registry_find_by_socket(Registry *registry, int client_socket, RegistryVisitor visit, void *context) {
+    UserHandle handle = USER_HANDLE_NONE;
+
+    pthread_rwlock_rdlock(&registry->socket_lock);
+    if (client_socket >= 0 && (size_t)client_socket < registry->by_socket_size) {
+        handle = registry->by_socket[client_socket];
+    }
+    pthread_rwlock_unlock(&registry->socket_lock);
+
+    return handle != USER_HANDLE_NONE && registry_get(registry, handle, visit, context);
+}
+
+// Visits every user, one shard read lock at a time; users joining or leaving
+// while the walk is in progress may or may not be seen
+void registry_for_each(Registry *registry, RegistryVisitor visit, void *context) {
+    for (size_t i = 0; i < REGISTRY_SHARDS; i++) {
+        RegistryShard *shard = &registry->shards[i];
+
+        pthread_rwlock_rdlock(&shard->lock);
+        for (size_t j = 0; j < shard->count; j++) {
+            visit(registry_slot(shard, shard->dense[j]), context);
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+size_t registry_count(Registry *registry) {
+    return atomic_load(&registry->count);
+}
+
+uint64_t registry_version(Registry *registry) {
+    return atomic_load(&registry->version);
+}
@@ -0,0 +1,110 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define USER_NAME_MAX 64
+
+// ConnectedUser.user_state, as the proto's Status numbers them
+#define USER_STATE_ONLINE 1
+#define USER_STATE_BUSY 2
+#define USER_STATE_OFFLINE 3
+#define REGISTRY_CHUNK_SIZE 1024
+#define REGISTRY_SHARD_BITS 6
+#define REGISTRY_SHARDS (1 << REGISTRY_SHARD_BITS)
+
+struct Session;
+
+// Stable reference to a registered user: shard and slot in the low 32 bits,
+// the slot's generation in the high 32 bits, so a handle kept after the
+// user left never resolves to whoever reuses the slot
+typedef uint64_t UserHandle;
+#define USER_HANDLE_NONE 0
+
+// Connected user structure
+typedef struct ConnectedUser {
+    char user_name[USER_NAME_MAX + 1];
+    _Atomic int32_t user_state;
+    struct Session *session; // the connection this user registered on
+    int client_socket;
+    char user_ip[INET_ADDRSTRLEN];
+    uint16_t user_port;
+    uint32_t name_hash;
+    uint32_t slot;
+    uint32_t generation;
+    uint32_t dense_index; // position in RegistryShard.dense while in use
+} ConnectedUser;
+
+// Slot of the open-addressing name index; slot_plus_one == 0 marks it empty
+typedef struct RegistryBucket {
+    uint32_t hash;
+    uint32_t slot_plus_one;
+} RegistryBucket;
+
+// One independently locked part of the registry. Users live in fixed-size
+// chunks that never move, indexed by name (linear probing) and listed in a
+// dense array so walking every user touches only live entries.
+typedef struct RegistryShard {
+    pthread_rwlock_t lock;
+    ConnectedUser **chunks;
+    size_t chunk_count;
+    uint32_t *free_slots;
+    size_t free_count;
+    size_t slot_count;
+
+    RegistryBucket *buckets;
+    size_t bucket_mask;
+
+    uint32_t *dense;
+    size_t dense_capacity;
+    size_t count;
+} __attribute__((aligned(64))) RegistryShard;
+
+// Users are spread over REGISTRY_SHARDS shards by name hash. Lookups and
+// walks only take shard read locks, and a join or leave write-locks the one
+// shard it touches, so readers elsewhere in the registry never wait on it.
+typedef struct Registry {
+    RegistryShard shards[REGISTRY_SHARDS];
+
+    // Secondary index by socket descriptor (direct-mapped)
+    pthread_rwlock_t socket_lock;
+    UserHandle *by_socket;
+    size_t by_socket_size;
+
+    atomic_size_t count;
+    // Bumped after every join, leave and state change, so a cached listing
+    // can tell it is out of date
+    _Atomic uint64_t version;
+} Registry;
+
+typedef enum RegistryStatus {
+    REGISTRY_OK,
+    REGISTRY_EXISTS,
+    REGISTRY_INVALID_NAME,
+    REGISTRY_NO_MEMORY
+} RegistryStatus;
+
+// Runs with the user's shard read-locked: it may read the entry, update
+// user_state atomically or take a reference on the session, but must not
+// block or call back into the registry
+typedef void (*RegistryVisitor)(ConnectedUser *user, void *context);
+
+bool registry_init(Registry *registry);
+void registry_destroy(Registry *registry);
+RegistryStatus registry_add(Registry *registry, const char *user_name, int32_t user_state, struct Session *session,
+                            int client_socket, const struct sockaddr_in *client_addr, UserHandle *handle);
+bool registry_remove(Registry *registry, UserHandle handle);
+bool registry_get(Registry *registry, UserHandle handle, RegistryVisitor visit, void *context);
+bool registry_find_by_name(Registry *registry, const char *user_name, RegistryVisitor visit, void *context);
+bool registry_find_by_socket(Registry *registry, int client_socket, RegistryVisitor visit, void *context);
+void registry_for_each(Registry *registry, RegistryVisitor visit, void *context);
+bool registry_set_state(Registry *registry, UserHandle handle, int32_t expected, int32_t user_state, char *user_name);
+size_t registry_count(Registry *registry);
+uint64_t registry_version(Registry *registry);
+
+#endif
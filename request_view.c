@@ -0,0 +1,147 @@
+#include "request_view.h"
+#include <string.h>
+
+// Field keys from chat.proto as they appear on the wire, (number << 3) |
+// wire type. All of them fit in one byte; a key spelled with more bytes
+// goes to the generic decoder.
+#define KEY_OPTION_OP 0x08           // UserOption.op, varint
+#define KEY_OPTION_MESSAGE 0x2A      // UserOption.message, length-delimited
+#define KEY_MESSAGE_PRIVATE 0x08     // Message.message_private, varint
+#define KEY_MESSAGE_DESTINATION 0x12 // Message.message_destination, length-delimited
+#define KEY_MESSAGE_CONTENT 0x1A     // Message.message_content, length-delimited
+#define KEY_MESSAGE_SENDER 0x22      // Message.message_sender, length-delimited
+
+// protobuf-c reads at most this many bytes of a varint, and of a length
+// prefix
+#define VARINT_MAX_BYTES 10
+#define LENGTH_MAX_BYTES 5
+
+static bool read_varint(const uint8_t **cursor, const uint8_t *end, int max_bytes, uint64_t *value) {
+    const uint8_t *p = *cursor;
+    uint64_t result = 0;
+    for (int i = 0; i < max_bytes && p < end; i++) {
+        uint8_t byte = *p++;
+        // The tenth byte only has room for the 64th bit
+        if (i == VARINT_MAX_BYTES - 1 && byte > 1) {
+            return false;
+        }
+        result |= (uint64_t)(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            *cursor = p;
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool read_string(const uint8_t **cursor, const uint8_t *end, StringView *view) {
+    uint64_t len;
+    if (!read_varint(cursor, end, LENGTH_MAX_BYTES, &len) || len > (uint64_t)(end - *cursor)) {
+        return false;
+    }
+    view->data = (const char *)*cursor;
+    view->len = (size_t)len;
+    *cursor += len;
+    return true;
+}
+
+static bool decode_message(const uint8_t *p, const uint8_t *end, MessageView *message) {
+    static const StringView empty = { "", 0 };
+    message->message_private = false;
+    message->message_destination = empty;
+    message->message_content = empty;
+    message->message_sender = empty;
+    while (p < end) {
+        uint8_t key = *p++;
+        uint64_t value;
+        StringView *field;
+        switch (key) {
+        case KEY_MESSAGE_PRIVATE:
+            if (!read_varint(&p, end, VARINT_MAX_BYTES, &value)) {
+                return false;
+            }
+            message->message_private = value != 0;
+            continue;
+        case KEY_MESSAGE_DESTINATION:
+            field = &message->message_destination;
+            break;
+        case KEY_MESSAGE_CONTENT:
+            field = &message->message_content;
+            break;
+        case KEY_MESSAGE_SENDER:
+            field = &message->message_sender;
+            break;
+        default:
+            return false;
+        }
+        // A repeated field replaces the earlier one, as in protobuf-c
+        if (!read_string(&p, end, field)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool request_view_decode(const uint8_t *data, size_t len, RequestView *view) {
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+    view->op = 0;
+    view->has_message = false;
+
+    while (p < end) {
+        uint8_t key = *p++;
+        if (key == KEY_OPTION_OP) {
+            uint64_t value;
+            if (!read_varint(&p, end, VARINT_MAX_BYTES, &value)) {
+                return false;
+            }
+            view->op = (int32_t)(uint32_t)value;
+        } else if (key == KEY_OPTION_MESSAGE) {
+            // protobuf-c merges a repeated message field; rare enough to
+            // leave to it
+            StringView bytes;
+            if (view->has_message || !read_string(&p, end, &bytes)) {
+                return false;
+            }
+            const uint8_t *first = (const uint8_t *)bytes.data;
+            if (!decode_message(first, first + bytes.len, &view->message)) {
+                return false;
+            }
+            view->has_message = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static char *copy_view(char **next, StringView view) {
+    char *copy = *next;
+    memcpy(copy, view.data, view.len);
+    copy[view.len] = '\0';
+    *next += view.len + 1;
+    return copy;
+}
+
+ChatSistOS__UserOption *request_view_option(const RequestView *view, Arena *arena, ChatSistOS__UserOption *option) {
+    chat_sist_os__user_option__init(option);
+    option->op = view->op;
+    if (!view->has_message) {
+        return option;
+    }
+    const MessageView *fields = &view->message;
+    size_t strings = fields->message_destination.len + fields->message_content.len + fields->message_sender.len + 3;
+    ChatSistOS__Message *message = arena_alloc(arena, sizeof(ChatSistOS__Message) + strings);
+    if (message == NULL) {
+        return NULL;
+    }
+    char *next = (char *)(message + 1);
+    chat_sist_os__message__init(message);
+    message->message_private = fields->message_private;
+    message->message_destination = copy_view(&next, fields->message_destination);
+    message->message_content = copy_view(&next, fields->message_content);
+    message->message_sender = copy_view(&next, fields->message_sender);
+    option->message = message;
+    return option;
+}
@@ -0,0 +1,43 @@
+#ifndef REQUEST_VIEW_H
+#define REQUEST_VIEW_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+#include "chat.pb-c.h"
+
+// A string field as it sits in the decoded buffer: not NUL-terminated,
+// and only valid as long as that buffer is
+typedef struct StringView {
+    const char *data;
+    size_t len;
+} StringView;
+
+typedef struct MessageView {
+    bool message_private;
+    StringView message_destination;
+    StringView message_content;
+    StringView message_sender;
+} MessageView;
+
+// The part of a UserOption that chat traffic uses: the op and a message
+typedef struct RequestView {
+    int32_t op;
+    bool has_message;
+    MessageView message;
+} RequestView;
+
+// Decodes a UserOption holding only op and message, pointing the views
+// into `data` instead of copying anything. Returns false for whatever else
+// comes in: other fields, unknown ones, encodings protobuf-c reads in ways
+// not worth copying here, and malformed input. Those are left to
+// chat_sist_os__user_option__unpack. When it returns true the generic
+// decoder would have produced the same values.
+bool request_view_decode(const uint8_t *data, size_t len, RequestView *view);
+// Fills `option` from a decoded view for the code written against
+// protobuf-c's structs. The message and its NUL-terminated strings go in
+// one arena allocation. NULL if the arena is out of memory.
+ChatSistOS__UserOption *request_view_option(const RequestView *view, Arena *arena, ChatSistOS__UserOption *option);
+
+#endif
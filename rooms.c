@@ -0,0 +1,184 @@
+#include "rooms.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t room_hash(const char *room_name, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)room_name[i];
+        hash *= 1099511628211ULL;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+bool rooms_init(RoomDirectory *rooms) {
+    memset(rooms, 0, sizeof(*rooms));
+    return pthread_mutex_init(&rooms->mutex, NULL) == 0;
+}
+
+// Called with the directory mutex held
+static Room **room_find(RoomDirectory *rooms, const char *room_name, uint32_t hash) {
+    Room **link = &rooms->buckets[hash & (ROOM_BUCKETS - 1)];
+    while (*link != NULL && ((*link)->hash != hash || strcmp((*link)->name, room_name) != 0)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static Room *room_create(const char *room_name, size_t len, uint32_t hash) {
+    Room *room = (Room *)calloc(1, sizeof(Room));
+    if (room == NULL) {
+        return NULL;
+    }
+    if (pthread_rwlock_init(&room->lock, NULL) != 0) {
+        free(room);
+        return NULL;
+    }
+    room->hash = hash;
+    memcpy(room->name, room_name, len + 1);
+    return room;
+}
+
+static void room_destroy(Room *room) {
+    pthread_rwlock_destroy(&room->lock);
+    free(room->members);
+    free(room);
+}
+
+static bool session_in_room(Session *session, const char *room_name, size_t *index) {
+    for (size_t i = 0; i < session->room_count; i++) {
+        if (strcmp(session->rooms[i]->name, room_name) == 0) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+RoomStatus rooms_join(RoomDirectory *rooms, const char *room_name, Session *session) {
+    size_t len = strlen(room_name);
+    if (len == 0 || len > ROOM_NAME_MAX) {
+        return ROOM_INVALID_NAME;
+    }
+    size_t index;
+    if (session_in_room(session, room_name, &index)) {
+        return ROOM_ALREADY_MEMBER;
+    }
+    if (session->room_count == SESSION_MAX_ROOMS) {
+        return ROOM_TOO_MANY;
+    }
+
+    uint32_t hash = room_hash(room_name, len);
+    pthread_mutex_lock(&rooms->mutex);
+    Room **link = room_find(rooms, room_name, hash);
+    Room *room = *link;
+    bool created = false;
+    if (room == NULL) {
+        room = room_create(room_name, len, hash);
+        if (room == NULL) {
+            pthread_mutex_unlock(&rooms->mutex);
+            return ROOM_NO_MEMORY;
+        }
+        created = true;
+    }
+
+    pthread_rwlock_wrlock(&room->lock);
+    if (room->member_count == room->member_capacity) {
+        size_t capacity = room->member_capacity > 0 ? room->member_capacity * 2 : 8;
+        Session **members = (Session **)realloc(room->members, capacity * sizeof(Session *));
+        if (members == NULL) {
+            pthread_rwlock_unlock(&room->lock);
+            if (created) {
+                room_destroy(room);
+            }
+            pthread_mutex_unlock(&rooms->mutex);
+            return ROOM_NO_MEMORY;
+        }
+        room->members = members;
+        room->member_capacity = capacity;
+    }
+    session_ref(session);
+    room->members[room->member_count++] = session;
+    pthread_rwlock_unlock(&room->lock);
+
+    if (created) {
+        *link = room;
+        rooms->count++;
+    }
+    pthread_mutex_unlock(&rooms->mutex);
+
+    session->rooms[session->room_count++] = room;
+    return ROOM_OK;
+}
+
+// Drops the session's membership of rooms[index], and the room with it if
+// the session was the last one in
+static void room_remove_member(RoomDirectory *rooms, Session *session, size_t index) {
+    Room *room = session->rooms[index];
+    session->rooms[index] = session->rooms[--session->room_count];
+
+    pthread_mutex_lock(&rooms->mutex);
+    pthread_rwlock_wrlock(&room->lock);
+    for (size_t i = 0; i < room->member_count; i++) {
+        if (room->members[i] == session) {
+            room->members[i] = room->members[--room->member_count];
+            break;
+        }
+    }
+    bool empty = room->member_count == 0;
+    pthread_rwlock_unlock(&room->lock);
+
+    if (empty) {
+        // Nobody can be sending to it: senders have to be members
+        Room **link = room_find(rooms, room->name, room->hash);
+        *link = room->next;
+        rooms->count--;
+    }
+    pthread_mutex_unlock(&rooms->mutex);
+
+    if (empty) {
+        room_destroy(room);
+    }
+    session_unref(session);
+}
+
+RoomStatus rooms_leave(RoomDirectory *rooms, const char *room_name, Session *session) {
+    size_t index;
+    if (!session_in_room(session, room_name, &index)) {
+        return ROOM_NOT_MEMBER;
+    }
+    room_remove_member(rooms, session, index);
+    return ROOM_OK;
+}
+
+void rooms_leave_all(RoomDirectory *rooms, Session *session) {
+    while (session->room_count > 0) {
+        room_remove_member(rooms, session, session->room_count - 1);
+    }
+}
+
+RoomStatus rooms_send(Session *sender, const char *room_name, SharedBuffer *delivery, size_t *recipients) {
+    size_t index;
+    if (!session_in_room(sender, room_name, &index)) {
+        return ROOM_NOT_MEMBER;
+    }
+
+    // Queuing never blocks, so the fan-out runs under the read lock and
+    // needs no copy of the member list
+    Room *room = sender->rooms[index];
+    pthread_rwlock_rdlock(&room->lock);
+    for (size_t i = 0; i < room->member_count; i++) {
+        session_enqueue(room->members[i], delivery);
+    }
+    *recipients = room->member_count;
+    pthread_rwlock_unlock(&room->lock);
+
+    metrics_record(METRIC_FANOUT, *recipients);
+    return ROOM_OK;
+}
+
+bool rooms_is_member(Session *session, const char *room_name) {
+    size_t index;
+    return session_in_room(session, room_name, &index);
+}
@@ -0,0 +1,56 @@
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "session.h"
+#include "shared_buffer.h"
+
+#define ROOM_NAME_MAX 64
+#define ROOM_BUCKETS 1024 // power of two
+
+typedef enum RoomStatus {
+    ROOM_OK,
+    ROOM_INVALID_NAME,
+    ROOM_ALREADY_MEMBER,
+    ROOM_NOT_MEMBER,
+    ROOM_TOO_MANY, // the session is in SESSION_MAX_ROOMS rooms already
+    ROOM_NO_MEMORY
+} RoomStatus;
+
+// A named channel. Members are a dense array of sessions, so a message to
+// the room is one pass over the few sessions in it instead of a walk over
+// every registered user.
+typedef struct Room {
+    struct Room *next; // directory bucket chain
+    uint32_t hash;
+    pthread_rwlock_t lock; // readers fan out, joins and leaves write
+    Session **members; // each holds a session reference
+    size_t member_count;
+    size_t member_capacity;
+    char name[ROOM_NAME_MAX + 1];
+} Room;
+
+// Rooms by name. A room is created by its first join and freed by its last
+// leave; both happen under the directory mutex, which is never taken to
+// send. A sender reaches the room through its own Session.rooms list, and
+// its membership keeps the room alive while it sends.
+typedef struct RoomDirectory {
+    pthread_mutex_t mutex;
+    Room *buckets[ROOM_BUCKETS];
+    size_t count;
+} RoomDirectory;
+
+bool rooms_init(RoomDirectory *rooms);
+// Join, leave and leave_all only run on the thread handling the session's
+// requests, which is what makes Session.rooms safe to use without a lock
+RoomStatus rooms_join(RoomDirectory *rooms, const char *room_name, Session *session);
+RoomStatus rooms_leave(RoomDirectory *rooms, const char *room_name, Session *session);
+void rooms_leave_all(RoomDirectory *rooms, Session *session);
+// Queues delivery to every member of one of the sender's rooms. Returns the
+// number of recipients through `recipients`.
+RoomStatus rooms_send(Session *sender, const char *room_name, SharedBuffer *delivery, size_t *recipients);
+bool rooms_is_member(Session *session, const char *room_name);
+
+#endif
@@ -0,0 +1,138 @@
+#include "roster.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct RosterBuilder {
+    RosterEntry *entries;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} RosterBuilder;
+
+static void roster_copy_user(ConnectedUser *user, void *context) {
+    RosterBuilder *builder = (RosterBuilder *)context;
+    if (builder->failed) {
+        return;
+    }
+    if (builder->count == builder->capacity) {
+        size_t capacity = builder->capacity > 0 ? builder->capacity * 2 : 64;
+        RosterEntry *entries = (RosterEntry *)realloc(builder->entries, capacity * sizeof(RosterEntry));
+        if (entries == NULL) {
+            builder->failed = true;
+            return;
+        }
+        builder->entries = entries;
+        builder->capacity = capacity;
+    }
+
+    RosterEntry *entry = &builder->entries[builder->count++];
+    memcpy(entry->user_name, user->user_name, sizeof(entry->user_name));
+    memcpy(entry->user_ip, user->user_ip, sizeof(entry->user_ip));
+    entry->user_state = atomic_load_explicit(&user->user_state, memory_order_relaxed);
+}
+
+static int roster_compare(const void *a, const void *b) {
+    return strcmp(((const RosterEntry *)a)->user_name, ((const RosterEntry *)b)->user_name);
+}
+
+bool roster_init(Roster *roster, Registry *registry, RosterEncoder encode) {
+    roster->registry = registry;
+    roster->encode = encode;
+    roster->current = NULL;
+
+    return pthread_mutex_init(&roster->mutex, NULL) == 0;
+}
+
+void roster_release(RosterSnapshot *snapshot) {
+    if (atomic_fetch_sub_explicit(&snapshot->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    if (snapshot->encoded != NULL) {
+        shared_buffer_unref(snapshot->encoded);
+    }
+    free(snapshot->entries);
+    free(snapshot);
+}
+
+// Tagged with the version read before the walk: a change that races the
+// walk leaves the snapshot looking stale, so the next request rebuilds it
+static RosterSnapshot *roster_build(Roster *roster, uint64_t version) {
+    RosterSnapshot *snapshot = (RosterSnapshot *)calloc(1, sizeof(RosterSnapshot));
+    if (snapshot == NULL) {
+        return NULL;
+    }
+
+    RosterBuilder builder = { NULL, 0, 0, false };
+    size_t expected = registry_count(roster->registry);
+    if (expected > 0) {
+        // Room for a few joins during the walk before the first realloc
+        builder.capacity = expected + expected / 8 + 1;
+        builder.entries = (RosterEntry *)malloc(builder.capacity * sizeof(RosterEntry));
+        builder.failed = builder.entries == NULL;
+    }
+    registry_for_each(roster->registry, roster_copy_user, &builder);
+    if (builder.failed) {
+        free(builder.entries);
+        free(snapshot);
+        return NULL;
+    }
+    qsort(builder.entries, builder.count, sizeof(RosterEntry), roster_compare);
+
+    atomic_init(&snapshot->refs, 1);
+    snapshot->version = version;
+    snapshot->count = builder.count;
+    snapshot->entries = builder.entries;
+    snapshot->encoded = roster->encode(snapshot);
+    if (snapshot->encoded == NULL) {
+        roster_release(snapshot);
+        return NULL;
+    }
+
+    return snapshot;
+}
+
+// Returns the current snapshot with a reference the caller drops with
+// roster_release, or NULL if a new one was due and could not be built
+RosterSnapshot *roster_acquire(Roster *roster) {
+    uint64_t version = registry_version(roster->registry);
+
+    // Held while building, so a burst of list requests after a change
+    // walks the registry once and the rest wait for that result
+    pthread_mutex_lock(&roster->mutex);
+    RosterSnapshot *snapshot = roster->current;
+    if (snapshot == NULL || snapshot->version != version) {
+        snapshot = roster_build(roster, version);
+        if (snapshot != NULL) {
+            if (roster->current != NULL) {
+                roster_release(roster->current);
+            }
+            roster->current = snapshot;
+        }
+    }
+    if (snapshot != NULL) {
+        atomic_fetch_add_explicit(&snapshot->refs, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&roster->mutex);
+
+    return snapshot;
+}
+
+size_t roster_seek(const RosterSnapshot *snapshot, const char *cursor) {
+    if (cursor == NULL || cursor[0] == '\0') {
+        return 0;
+    }
+
+    size_t low = 0;
+    size_t high = snapshot->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (strcmp(snapshot->entries[middle].user_name, cursor) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
@@ -0,0 +1,49 @@
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "registry.h"
+#include "shared_buffer.h"
+
+// One user as the snapshot saw them
+typedef struct RosterEntry {
+    char user_name[USER_NAME_MAX + 1];
+    char user_ip[INET_ADDRSTRLEN];
+    int32_t user_state;
+} RosterEntry;
+
+// Immutable copy of the registry sorted by name, tagged with the registry
+// version it was taken at. Pages are cut from it by name, so a cursor stays
+// meaningful across snapshots.
+typedef struct RosterSnapshot {
+    atomic_int refs;
+    uint64_t version;
+    size_t count;
+    RosterEntry *entries;
+    SharedBuffer *encoded; // the whole listing, serialized once per snapshot
+} RosterSnapshot;
+
+// Serializes a full listing for a fresh snapshot
+typedef SharedBuffer *(*RosterEncoder)(const RosterSnapshot *snapshot);
+
+// The current snapshot of a registry. List requests share it until someone
+// joins or leaves; only then does the next one pay for a new walk.
+typedef struct Roster {
+    Registry *registry;
+    RosterEncoder encode;
+    pthread_mutex_t mutex;
+    RosterSnapshot *current;
+} Roster;
+
+bool roster_init(Roster *roster, Registry *registry, RosterEncoder encode);
+RosterSnapshot *roster_acquire(Roster *roster);
+void roster_release(RosterSnapshot *snapshot);
+// Index of the first user after `cursor` (a name), 0 for an empty cursor
+size_t roster_seek(const RosterSnapshot *snapshot, const char *cursor);
+
+#endif
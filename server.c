@@ -1,47 +1,102 @@
+#include "arena.h"
 #include "chat.pb-c.h"
+#include "framing.h"
+#include "history.h"
+#include "log.h"
+#include "mailbox.h"
+#include "message_log.h"
+#include "metrics.h"
+#include "presence.h"
+#include "reactor.h"
+#include "roster.h"
+#include "rooms.h"
+#include "registry.h"
+#include "request_view.h"
+#include "session.h"
+#include "shared_buffer.h"
+#include "timer_wheel.h"
+#include "workpool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <signal.h>
+#include <sched.h>
 
-// Connected user structure
-typedef struct ConnectedUser {
-    ChatSistOS__User user;
-    int client_socket;
-    char user_ip[INET_ADDRSTRLEN];
-    uint16_t user_port; // Add the port number field
-    struct ConnectedUser *next;
-} ConnectedUser;
 // Function prototypes
-void add_broadcast_message(ChatSistOS__Message *message);
-bool add_connected_user(ChatSistOS__User *user, int client_socket, struct sockaddr_in *client_addr);
-void print_connected_users();
-void remove_connected_user(int client_socket);
-ConnectedUser *find_user_by_name(const char *name);
+void add_broadcast_message(SharedBuffer *delivery);
+uint32_t conversation_key(MessageLogKind kind, const char *name, const char *peer);
+void store_delivery(MessageLogKind kind, ChatSistOS__Message *message, SharedBuffer *delivery);
+void load_recent_broadcasts(void);
+RegistryStatus add_connected_user(const char *user_name, Session *session);
+void print_connected_user(Session *session);
+void remove_connected_user(Session *session);
+Session *find_session_by_name(const char *name);
 ChatSistOS__Message *create_message(const char *text);
-char *get_user_list(bool list_all, const char *specific_user);
-void handle_error(const char *message, int client_socket);
+SharedBuffer *pack_user_page(const RosterSnapshot *snapshot, size_t first, size_t count);
+SharedBuffer *encode_user_list(const RosterSnapshot *snapshot);
+void send_user_list(Session *session, ChatSistOS__UserList *query);
+void send_user_info(Session *session, const char *user_name);
 void *client_handler(void *client_data_ptr);
-void send_message_to_all_clients(ChatSistOS__Message *message);
-void send_message_to_specific_client(ChatSistOS__Message *message, ConnectedUser *target_user);
-
-// Mutex for shared data
-pthread_mutex_t shared_data_mutex;
-
-// Broadcast message structure
-typedef struct BroadcastMessage {
-    ChatSistOS__Message message;
-    struct BroadcastMessage *next;
-} BroadcastMessage;
-
-BroadcastMessage *broadcast_messages_head = NULL;
-
-ConnectedUser *connected_users_head = NULL;
+void process_request(Session *session, const uint8_t *buf, size_t len);
+void close_session(Session *session);
+void send_answer(Session *session, ChatSistOS__Answer *answer);
+SharedBuffer *pack_answer(ChatSistOS__Answer *answer);
+SharedBuffer *pack_delivery(ChatSistOS__Message *message);
+void send_message_to_all_clients(SharedBuffer *delivery);
+void send_message_to_specific_client(SharedBuffer *delivery, Session *target_session);
+void send_private_message(Session *session, ChatSistOS__Message *message);
+void update_user_status(Session *session, ChatSistOS__Status *status);
+void update_room_membership(Session *session, ChatSistOS__Room *room);
+void send_room_message(Session *session, ChatSistOS__Message *message);
+void send_history(Session *session, ChatSistOS__HistoryQuery *query);
+void mark_session_active(Session *session, uint64_t now_ms);
+
+// Recent broadcasts, replayed to users when they register
+History broadcast_history;
+size_t history_replay_count = HISTORY_REPLAY_DEFAULT;
+// Every delivery on disk, when the server runs with -D; NULL otherwise
+MessageLog *message_log = NULL;
+// Op 8: messages one answer carries when the client does not say, and at
+// most; and how many log records one query looks through, matching or not
+#define HISTORY_QUERY_DEFAULT 50
+#define HISTORY_QUERY_MAX 500
+#define HISTORY_QUERY_SCAN (64 * 1024)
+
+Registry connected_users;
+// Sorted, versioned copy of connected_users that op 2 listings are cut from
+Roster user_roster;
+// Most users one op 2 page carries. A User is at most about 100 bytes on
+// the wire, so a full page stays well under FRAME_MAX_PAYLOAD.
+#define USER_PAGE_MAX 4096
+// Join/leave/status deltas for sessions that subscribed with their listing
+Presence user_presence;
+// Named rooms; a message to one only reaches its members
+RoomDirectory chat_rooms;
+// Direct messages to users who are not connected, until they register
+Mailboxes offline_mail;
+
+// Users idle this long go from online to busy until their next request
+#define AUTO_AWAY_DEFAULT_MS (5 * 60 * 1000)
+uint64_t auto_away_ms = AUTO_AWAY_DEFAULT_MS;
+// Clients quiet this long are pinged, and dropped after
+// SESSION_HEARTBEAT_MISSES unanswered pings
+#define HEARTBEAT_DEFAULT_MS (30 * 1000)
+// Auto-away, heartbeats and the presence window all run on this wheel
+TimerWheel server_timers;
+
+// Threaded mode: drains every client's output queue
+ReactorLoop *writer_loop = NULL;
+
+// Scratch memory for the request being handled on this thread: the
+// decoded UserOption and the Answer built for it. Reset after each request.
+static __thread Arena request_arena;
 
 typedef struct ClientData {
     int client_socket;
@@ -49,16 +104,140 @@ typedef struct ClientData {
 } ClientData;
 
 int main(int argc, char *argv[]) {
-    if (argc != 2){
-    fprintf(stderr, "Uso: %s <puerto>\n", argv[0]);
+    // -e <hilos> switches from one thread per client to the epoll reactor;
+    // -q/-m/-p bound each client's output queue and pick what to do past it;
+    // -r sets how many past broadcasts a new user is shown; -M is where
+    // SIGUSR1 writes the metrics; -l/-L pick the log level and file;
+    // -k gives every epoll thread its own SO_REUSEPORT listener; -w moves
+    // request handling off them to a pool of worker threads; -a is the
+    // idle time in seconds before a user shows as busy (0 = never); -H is
+    // the silence in seconds before a client is pinged (0 = never); -D is
+    // the directory the messages are kept in across restarts
+    int io_threads = 0;
+    int workers = 0;
+    bool reuseport = false;
+    size_t queue_bytes = SESSION_QUEUE_HIGH_WATER;
+    size_t queue_messages = SESSION_QUEUE_MAX_MESSAGES;
+    QueueOverflowPolicy queue_policy = QUEUE_DROP_OLDEST;
+    const char *metrics_path = METRICS_DEFAULT_PATH;
+    const char *log_path = NULL;
+    LogLevel log_level = LOG_INFO;
+    uint64_t heartbeat_ms = HEARTBEAT_DEFAULT_MS;
+    const char *message_dir = NULL;
+    bool usage_error = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:kw:a:H:D:q:m:p:r:M:l:L:")) != -1) {
+        if (opt == 'e') {
+            io_threads = atoi(optarg);
+        } else if (opt == 'k') {
+            reuseport = true;
+        } else if (opt == 'w') {
+            workers = atoi(optarg);
+        } else if (opt == 'a') {
+            auto_away_ms = strtoull(optarg, NULL, 10) * 1000;
+        } else if (opt == 'H') {
+            heartbeat_ms = strtoull(optarg, NULL, 10) * 1000;
+        } else if (opt == 'D') {
+            message_dir = optarg;
+        } else if (opt == 'q') {
+            queue_bytes = strtoul(optarg, NULL, 10);
+        } else if (opt == 'm') {
+            queue_messages = strtoul(optarg, NULL, 10);
+        } else if (opt == 'l') {
+            usage_error |= !log_parse_level(optarg, &log_level);
+        } else if (opt == 'L') {
+            log_path = optarg;
+        } else if (opt == 'M') {
+            metrics_path = optarg;
+        } else if (opt == 'r') {
+            history_replay_count = strtoul(optarg, NULL, 10);
+        } else if (opt == 'p' && strcmp(optarg, "drop") == 0) {
+            queue_policy = QUEUE_DROP_OLDEST;
+        } else if (opt == 'p' && strcmp(optarg, "disconnect") == 0) {
+            queue_policy = QUEUE_DISCONNECT;
+        } else {
+            usage_error = true;
+        }
+    }
+    if (usage_error || argc - optind != 1 || io_threads < 0 || ((reuseport || workers != 0) && io_threads == 0) || workers < 0 || queue_bytes == 0 || queue_messages == 0){
+    fprintf(stderr, "Uso: %s [-e hilos_io [-k] [-w hilos_trabajo]] [-a segundos_inactivo] [-H segundos_latido] [-D dir_mensajes] [-q bytes_cola] [-m mensajes_cola] [-p drop|disconnect] [-r historial] [-M metricas] [-l debug|info|warn|error] [-L log] <puerto>\n", argv[0]);
     exit(EXIT_FAILURE);
     }
-    int port = atoi(argv[1]);
+    session_set_queue_limits(queue_bytes, queue_messages, queue_policy);
+    int port = atoi(argv[optind]);
     
+    if (!history_init(&broadcast_history, HISTORY_DEFAULT_BYTES, HISTORY_DEFAULT_ENTRIES)) {
+        perror("Error al inicializar el historial de mensajes");
+        return 1;
+    }
+    if (!registry_init(&connected_users) || !roster_init(&user_roster, &connected_users, encode_user_list)) {
+        perror("Error al inicializar el registro de usuarios");
+        return 1;
+    }
+    if (!rooms_init(&chat_rooms) || !mailbox_init(&offline_mail)) {
+        perror("Error al inicializar las salas y los buzones");
+        return 1;
+    }
+    // Peers that hang up must not kill the server with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    // Before any other thread: they all inherit the blocked SIGUSR1
+    if (!metrics_start(metrics_path)) {
+        perror("Error al iniciar las métricas");
+        return 1;
+    }
+    // Opened before the logger starts, so what is wrong with a segment
+    // reaches stderr before the server gives up
+    if (message_dir != NULL) {
+        static MessageLog durable_log;
+        if (!message_log_open(&durable_log, message_dir, MESSAGE_LOG_DEFAULT_SEGMENTS)) {
+            perror("Error al abrir el registro de mensajes");
+            return 1;
+        }
+        message_log = &durable_log;
+    }
+    int log_fd = log_path != NULL ? open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : STDOUT_FILENO;
+    if (log_fd < 0 || !log_init(log_fd, log_level)) {
+        perror("Error al iniciar el registro de eventos");
+        return 1;
+    }
+    if (message_log != NULL) {
+        load_recent_broadcasts();
+    }
+    if (!timer_wheel_start(&server_timers)) {
+        perror("Error al iniciar los temporizadores");
+        return 1;
+    }
+    if (!presence_init(&user_presence, &server_timers)) {
+        perror("Error al iniciar las notificaciones de presencia");
+        return 1;
+    }
+    if (heartbeat_ms > 0) {
+        // Every ping is the same few bytes; sessions queue references to one
+        ChatSistOS__Answer ping = CHAT_SIST_OS__ANSWER__INIT;
+        ping.op = SESSION_HEARTBEAT_OP;
+        ping.response_status_code = 200;
+        SharedBuffer *packed_ping = pack_answer(&ping);
+        if (packed_ping == NULL) {
+            perror("Error al preparar el latido");
+            return 1;
+        }
+        session_set_heartbeat(&server_timers, heartbeat_ms, packed_ping);
+    }
+    static WorkPool request_pool;
+    if (workers > 0) {
+        if (!workpool_start(&request_pool, workers, process_request, close_session)) {
+            return 1;
+        }
+        reactor_set_pool(&request_pool);
+    }
     int server_socket, client_socket;
     struct sockaddr_in server_addr, client_addr;
     socklen_t addr_size;
     pthread_t thread_id;
+    if (reuseport) {
+        log_info("Servidor iniciado en el puerto %d...", port);
+        return reactor_run_reuseport(port, io_threads, process_request, close_session) < 0 ? 1 : 0;
+    }
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0) {
         perror("Error al crear el socket del servidor");
@@ -73,14 +252,17 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    if (listen(server_socket, 5) < 0) {
+    if (listen(server_socket, SOMAXCONN) < 0) {
         perror("Error al escuchar en el socket del servidor");
         return 1;
     }
 
-    printf("Servidor iniciado en el puerto %d...\n", port);
-    if (pthread_mutex_init(&shared_data_mutex, NULL) != 0) {
-        perror("Error al inicializar el mutex");
+    log_info("Servidor iniciado en el puerto %d...", port);
+    if (io_threads > 0) {
+        return reactor_run(server_socket, io_threads, process_request, close_session) < 0 ? 1 : 0;
+    }
+    writer_loop = reactor_start_writer();
+    if (writer_loop == NULL) {
         return 1;
     }
     while (1) {
@@ -88,14 +270,14 @@ int main(int argc, char *argv[]) {
         client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_size);
 
         if (client_socket < 0) {
-            perror("Error al aceptar conexión del cliente");
+            log_error("Error al aceptar conexión del cliente: %m");
             continue;
         }
-        printf("Cliente conectado desde %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        log_info("Cliente conectado desde %s:%d", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
 
         ClientData *client_data_ptr = (ClientData *)malloc(sizeof(ClientData));
         if (client_data_ptr == NULL) {
-            perror("Error al asignar memoria para el puntero de datos del cliente");
+            log_error("Error al asignar memoria para el puntero de datos del cliente: %m");
             continue;
         }
 
@@ -103,14 +285,14 @@ int main(int argc, char *argv[]) {
         client_data_ptr->client_addr = client_addr;
 
         if (pthread_create(&thread_id, NULL, client_handler, (void *)client_data_ptr) != 0) {
-            perror("Error al crear el hilo para el cliente");
+            log_error("Error al crear el hilo para el cliente: %m");
             continue;
         }
 
         pthread_detach(thread_id);
     }
 
-    pthread_mutex_destroy(&shared_data_mutex);
+    history_destroy(&broadcast_history);
     if(close(server_socket)<0){
         perror("Error al cerrar el socket del servidor");
     }
@@ -119,262 +301,1026 @@ int main(int argc, char *argv[]) {
 }
 
 // Function implementations
-void add_broadcast_message(ChatSistOS__Message *message) {
-    BroadcastMessage *new_node = (BroadcastMessage *)malloc(sizeof(BroadcastMessage));
-    if (new_node == NULL) {
-        perror("Error al asignar memoria para el nuevo mensaje");
-        return;
+// Keeps the serialized delivery; the ring overwrites the oldest ones
+void add_broadcast_message(SharedBuffer *delivery) {
+    if (history_append(&broadcast_history, delivery->data, delivery->len) == 0) {
+        log_warn("Mensaje demasiado grande para el historial");
     }
+}
 
-    new_node->message = *message;
-    new_node->next = broadcast_messages_head;
-    broadcast_messages_head = new_node;
+static uint64_t hash_text(uint64_t hash, const char *text) {
+    // The terminator goes in too, so "ab"+"c" and "a"+"bc" differ
+    do {
+        hash ^= (uint8_t)*text;
+        hash *= 1099511628211ULL;
+    } while (*text++ != '\0');
+    return hash;
+}
 
-    printf("Broadcast message: %s\n", message->message_content);
+// The conversation a delivery belongs to, as tagged in the log: the general
+// chat, a room by name, or the direct messages between two users, whichever
+// of them sent each one
+uint32_t conversation_key(MessageLogKind kind, const char *name, const char *peer) {
+    uint64_t hash = (14695981039346656037ULL ^ (uint64_t)kind) * 1099511628211ULL;
+    if (kind == MESSAGE_LOG_ROOM) {
+        hash = hash_text(hash, name);
+    } else if (kind == MESSAGE_LOG_DIRECT) {
+        bool ordered = strcmp(name, peer) <= 0;
+        hash = hash_text(hash_text(hash, ordered ? name : peer), ordered ? peer : name);
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
 }
 
-bool add_connected_user(ChatSistOS__User *user, int client_socket, struct sockaddr_in *client_addr) {
-    ConnectedUser *new_node = (ConnectedUser *)malloc(sizeof(ConnectedUser));
-    if (new_node == NULL) {
-        return false;
+// Appends the delivery to the on-disk log. The committer syncs it shortly
+// after; the send does not wait for that. A direct message's sender is the
+// registered name stamp_sender put there, so its conversation is the one
+// the history query of either user looks for.
+void store_delivery(MessageLogKind kind, ChatSistOS__Message *message, SharedBuffer *delivery) {
+    if (message_log == NULL) {
+        return;
+    }
+    const char *name = kind == MESSAGE_LOG_DIRECT ? message->message_sender : message->message_destination;
+    uint32_t thread = conversation_key(kind, name, message->message_destination);
+    if (message_log_append(message_log, kind, thread, delivery->data, delivery->len) == MESSAGE_LOG_NONE) {
+        log_error("Error al guardar el mensaje en el registro de mensajes");
     }
+}
 
-    new_node->user = *user;
-    new_node->client_socket = client_socket;
-    inet_ntop(AF_INET, &(client_addr->sin_addr), new_node->user_ip, INET_ADDRSTRLEN);
-    new_node->user_port = ntohs(client_addr->sin_port); // Store the port number
-    new_node->next = connected_users_head;
-    connected_users_head = new_node;
+typedef struct BroadcastLoad {
+    size_t found;
+    size_t skip; // older broadcasts than the history is refilled with
+} BroadcastLoad;
 
+static bool count_broadcast(uint64_t offset, const MessageLogRecord *record, const uint8_t *data, void *context) {
+    (void)offset;
+    (void)data;
+    if (record->kind == MESSAGE_LOG_BROADCAST) {
+        ((BroadcastLoad *)context)->found++;
+    }
     return true;
 }
 
-void print_connected_users() {
-    ConnectedUser *current_node = connected_users_head;
-    printf("Connected users:\n");
-
-    if (current_node == NULL) {
-        printf("No users connected.\n");
-        return;
+static bool load_broadcast(uint64_t offset, const MessageLogRecord *record, const uint8_t *data, void *context) {
+    (void)offset;
+    BroadcastLoad *load = (BroadcastLoad *)context;
+    if (record->kind != MESSAGE_LOG_BROADCAST) {
+        return true;
     }
+    if (load->skip > 0) {
+        load->skip--;
+    } else {
+        history_append(&broadcast_history, data, record->len);
+    }
+    return true;
+}
 
-    while (current_node != NULL) {
-        printf("User: %s, State: %d, IP: %s, Port: %u\n", current_node->user.user_name, current_node->user.user_state, current_node->user_ip, current_node->user_port);
-        current_node = current_node->next;
+// Refills the broadcast history with the newest HISTORY_DEFAULT_ENTRIES
+// broadcasts of the last run. Direct and room messages share the log, so
+// it walks back in growing windows until it has seen that many broadcasts
+// or reached the oldest record, then replays them in order.
+void load_recent_broadcasts(void) {
+    uint64_t first = message_log_first_offset(message_log);
+    uint64_t next = message_log_next_offset(message_log);
+    BroadcastLoad load = { 0, 0 };
+    uint64_t from = next;
+    uint64_t window = HISTORY_DEFAULT_ENTRIES;
+    while (from > first && load.found < HISTORY_DEFAULT_ENTRIES) {
+        uint64_t end = from;
+        from = end - first > window ? end - window : first;
+        message_log_read(message_log, from, (size_t)(end - from), count_broadcast, &load);
+        window *= 2;
     }
+    load.skip = load.found > HISTORY_DEFAULT_ENTRIES ? load.found - HISTORY_DEFAULT_ENTRIES : 0;
+    size_t loaded = load.found - load.skip;
+    message_log_read(message_log, from, (size_t)(next - from), load_broadcast, &load);
+    log_info("Registro de mensajes abierto: %llu mensajes, %zu difusiones leídas para el historial",
+             (unsigned long long)(next - first), loaded);
 }
 
-void remove_connected_user(int client_socket) {
-    ConnectedUser *current_node = connected_users_head;
-    ConnectedUser *previous_node = NULL;
+static void return_from_away(Session *session) {
+    int away = SESSION_AWAY;
+    if (atomic_compare_exchange_strong(&session->away, &away, SESSION_PRESENT)) {
+        char user_name[USER_NAME_MAX + 1];
+        if (registry_set_state(&connected_users, atomic_load(&session->idle_handle), USER_STATE_BUSY, USER_STATE_ONLINE, user_name)) {
+            presence_status(&user_presence, user_name, USER_STATE_ONLINE);
+        }
+    }
+}
 
-    while (current_node != NULL) {
-        if (current_node->client_socket == client_socket) {
-            if (previous_node == NULL) {
-                connected_users_head = current_node->next;
-            } else {
-                previous_node->next = current_node->next;
+static void idle_timer_fired(TimerEntry *entry) {
+    Session *session = (Session *)((char *)entry - offsetof(Session, idle_timer));
+    // Loaded before the clock is read; a request stamping a newer time in
+    // between means the user is active, not idle for 2^64 ms
+    uint64_t last_active_ms = atomic_load(&session->last_active_ms);
+    uint64_t now_ms = metrics_now() / 1000000;
+    uint64_t idle = last_active_ms < now_ms ? now_ms - last_active_ms : 0;
+    uint64_t wait = auto_away_ms;
+
+    if (idle < auto_away_ms) {
+        wait = auto_away_ms - idle;
+    } else {
+        int present = SESSION_PRESENT;
+        if (atomic_compare_exchange_strong(&session->away, &present, SESSION_GOING_AWAY)) {
+            char user_name[USER_NAME_MAX + 1];
+            bool changed = registry_set_state(&connected_users, atomic_load(&session->idle_handle), USER_STATE_ONLINE, USER_STATE_BUSY, user_name);
+            if (changed) {
+                presence_status(&user_presence, user_name, USER_STATE_BUSY);
+            }
+            atomic_store(&session->away, changed ? SESSION_AWAY : SESSION_PRESENT);
+            // A request that came in meanwhile saw SESSION_GOING_AWAY and
+            // left the way back to us
+            if (changed && atomic_load(&session->last_active_ms) != last_active_ms) {
+                return_from_away(session);
             }
-
-            free(current_node);
-            break;
         }
+    }
 
-        previous_node = current_node;
-        current_node = current_node->next;
+    if (!timer_wheel_schedule(&server_timers, entry, wait)) {
+        session_unref(session);
     }
 }
 
-ConnectedUser *find_user_by_name(const char *name) {
-    ConnectedUser *current_node = connected_users_head;
+// One timer per session from its first registration until it closes; it
+// follows whichever user the session has registered since
+static void start_idle_timer(Session *session) {
+    atomic_store(&session->idle_handle, session->user_handle);
+    if (auto_away_ms == 0 || session->idle_timer.fire != NULL) {
+        return;
+    }
+    timer_entry_init(&session->idle_timer, idle_timer_fired);
+    session_ref(session);
+    if (!timer_wheel_schedule(&server_timers, &session->idle_timer, auto_away_ms)) {
+        session_unref(session);
+    }
+}
 
-    while (current_node != NULL) {
-        if (strcmp(current_node->user.user_name, name) == 0) {
-            return current_node;
-        }
-        current_node = current_node->next;
+// Called on every request; only touches the registry if the idle timer
+// had made the user busy
+void mark_session_active(Session *session, uint64_t now_ms) {
+    atomic_store(&session->last_active_ms, now_ms);
+    if (atomic_load(&session->away) == SESSION_AWAY) {
+        return_from_away(session);
     }
+}
 
-    return NULL;
+RegistryStatus add_connected_user(const char *user_name, Session *session) {
+    RegistryStatus status = registry_add(&connected_users, user_name, USER_STATE_ONLINE, session, session->client_socket, &session->client_addr, &session->user_handle);
+    if (status == REGISTRY_OK) {
+        char user_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &session->client_addr.sin_addr, user_ip, sizeof(user_ip));
+        presence_joined(&user_presence, user_name, user_ip, USER_STATE_ONLINE);
+        start_idle_timer(session);
+    }
+    return status;
+}
+
+static void print_user(ConnectedUser *user, void *context) {
+    log_info("User: %s, State: %d, IP: %s, Port: %u", user->user_name, atomic_load(&user->user_state), user->user_ip, user->user_port);
+}
+
+// One line per registration; the full list is one op 2 away and printing
+// it every time made registration O(users)
+void print_connected_user(Session *session) {
+    registry_get(&connected_users, session->user_handle, print_user, NULL);
+}
+
+static void copy_user_name(ConnectedUser *user, void *context) {
+    memcpy(context, user->user_name, sizeof(user->user_name));
+}
+
+// Puts the name the session registered with in the message's sender, over
+// whatever the client wrote there: deliveries, mailboxes and the history
+// log all go by it. False if the session has no registered user.
+static bool stamp_sender(Session *session, ChatSistOS__Message *message) {
+    char user_name[USER_NAME_MAX + 1];
+    if (session->user_handle == USER_HANDLE_NONE ||
+        !registry_get(&connected_users, session->user_handle, copy_user_name, user_name)) {
+        return false;
+    }
+    char *sender = arena_strdup(&request_arena, user_name);
+    if (sender == NULL) {
+        return false;
+    }
+    message->message_sender = sender;
+    return true;
+}
+
+// Also takes the session out of its rooms: they are for registered users
+void remove_connected_user(Session *session) {
+    rooms_leave_all(&chat_rooms, session);
+    char user_name[USER_NAME_MAX + 1];
+    if (registry_get(&connected_users, session->user_handle, copy_user_name, user_name) &&
+        registry_remove(&connected_users, session->user_handle)) {
+        presence_left(&user_presence, user_name);
+    }
+    session->user_handle = USER_HANDLE_NONE;
+}
+
+static void take_session_ref(ConnectedUser *user, void *context) {
+    session_ref(user->session);
+    *(Session **)context = user->session;
+}
+
+// Returns the session of an online user with a reference the caller must
+// drop with session_unref, or NULL
+Session *find_session_by_name(const char *name) {
+    Session *session = NULL;
+    registry_find_by_name(&connected_users, name, take_session_ref, &session);
+    return session;
 }
 
+// Lives in the request arena; gone once the request has been answered
 ChatSistOS__Message *create_message(const char *text) {
-    ChatSistOS__Message *message = malloc(sizeof(ChatSistOS__Message));
+    ChatSistOS__Message *message = arena_alloc(&request_arena, sizeof(ChatSistOS__Message));
+    char *content = arena_strdup(&request_arena, text);
+    if (message == NULL || content == NULL) {
+        return NULL;
+    }
     chat_sist_os__message__init(message);
 
-    message->message_content = strdup(text);
+    message->message_content = content;
 
     return message;
 }
 
-char *get_user_list(bool list_all, const char *specific_user) {
-    ConnectedUser *current_node = connected_users_head;
-    size_t buffer_size = 1024;
-    char *buffer = (char *)malloc(buffer_size);
-    size_t used_buffer = 0;
+// Builds the cached first page of every new snapshot
+SharedBuffer *encode_user_list(const RosterSnapshot *snapshot) {
+    return pack_user_page(snapshot, 0, snapshot->count < USER_PAGE_MAX ? snapshot->count : USER_PAGE_MAX);
+}
 
-    if (connected_users_head == NULL) {
-        snprintf(buffer, buffer_size, "No hay usuarios conectados\n");
-        return buffer;
+// Answers with the snapshot's users from the cursor on, at most
+// USER_PAGE_MAX of them however many were asked for. A first page of the
+// full size reuses the encoding made with the snapshot, so until someone
+// joins or leaves it costs one reference.
+void send_user_list(Session *session, ChatSistOS__UserList *query) {
+    RosterSnapshot *snapshot = roster_acquire(&user_roster);
+    SharedBuffer *page = NULL;
+    if (snapshot != NULL) {
+        size_t first = roster_seek(snapshot, query->cursor);
+        size_t count = snapshot->count - first;
+        size_t page_size = query->page_size > 0 && query->page_size < USER_PAGE_MAX ? query->page_size : USER_PAGE_MAX;
+        if (page_size < count) {
+            count = page_size;
+        }
+        if (first == 0 && page_size == USER_PAGE_MAX) {
+            page = snapshot->encoded;
+            shared_buffer_ref(page);
+        } else {
+            page = pack_user_page(snapshot, first, count);
+        }
+        roster_release(snapshot);
     }
 
-    while (current_node != NULL) {
-        if (list_all || strcmp(current_node->user.user_name, specific_user) == 0) {
-            size_t needed_space = strlen(current_node->user.user_name) + 4;
-            if (used_buffer + needed_space >= buffer_size) {
-                buffer_size *= 2;
-                buffer = (char *)realloc(buffer, buffer_size);
-            }
-            used_buffer += snprintf(buffer + used_buffer, needed_space, "%s [%d]\n", current_node->user.user_name, current_node->user.user_state);
+    if (page == NULL) {
+        ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+        answer.op = 2;
+        answer.response_status_code = 400;
+        answer.message = create_message("Error al obtener la lista de usuarios");
+        send_answer(session, &answer);
+        return;
+    }
+    session_enqueue(session, page);
+    shared_buffer_unref(page);
+}
+
+static void copy_user_info(ConnectedUser *user, void *context) {
+    ChatSistOS__User *info = (ChatSistOS__User *)context;
+    info->user_name = arena_strdup(&request_arena, user->user_name);
+    info->user_ip = arena_strdup(&request_arena, user->user_ip);
+    info->user_state = atomic_load(&user->user_state);
+}
+
+// One user, straight from the registry
+void send_user_info(Session *session, const char *user_name) {
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    ChatSistOS__User info = CHAT_SIST_OS__USER__INIT;
+    answer.op = 2;
+
+    if (registry_find_by_name(&connected_users, user_name, copy_user_info, &info) &&
+        info.user_name != NULL && info.user_ip != NULL) {
+        answer.response_status_code = 200;
+        answer.user = &info;
+    } else {
+        char text[USER_NAME_MAX + 64];
+        snprintf(text, sizeof(text), "El usuario %.*s no está conectado", USER_NAME_MAX, user_name);
+        answer.response_status_code = 400;
+        answer.message = create_message(text);
+    }
+
+    send_answer(session, &answer);
+}
+
+typedef struct SessionList {
+    Session **sessions;
+    size_t count;
+    size_t capacity;
+} SessionList;
+
+static void collect_session(ConnectedUser *user, void *context) {
+    SessionList *list = (SessionList *)context;
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+        Session **grown = (Session **)realloc(list->sessions, capacity * sizeof(Session *));
+        if (grown == NULL) {
+            return;
         }
-        current_node = current_node->next;
+        list->sessions = grown;
+        list->capacity = capacity;
+    }
+    session_ref(user->session);
+    list->sessions[list->count++] = user->session;
+}
+
+// Every recipient gets the same serialized bytes
+void send_message_to_all_clients(SharedBuffer *delivery) {
+    // The epoll loops each fan out to their own clients
+    if (reactor_broadcast(delivery)) {
+        metrics_record(METRIC_FANOUT, registry_count(&connected_users));
+        return;
+    }
+
+    // Take references under the shard read locks, send with no lock held
+    SessionList recipients = { NULL, 0, 0 };
+    registry_for_each(&connected_users, collect_session, &recipients);
+    metrics_record(METRIC_FANOUT, recipients.count);
+
+    for (size_t i = 0; i < recipients.count; i++) {
+        send_message_to_specific_client(delivery, recipients.sessions[i]);
+        session_unref(recipients.sessions[i]);
     }
+    free(recipients.sessions);
+}
+
+void send_message_to_specific_client(SharedBuffer *delivery, Session *target_session) {
+    session_enqueue(target_session, delivery);
+}
+
+static bool deliver_if_online(const char *user_name, SharedBuffer *delivery, void *context) {
+    (void)context;
+    Session *recipient = find_session_by_name(user_name);
+    if (recipient == NULL) {
+        return false;
+    }
+    bool queued = session_enqueue(recipient, delivery);
+    session_unref(recipient);
+    return queued;
+}
+
+// Routes a direct message through the registry to the recipient's queue,
+// or to their mailbox if they are not connected, and tells the sender
+// which one it was
+void send_private_message(Session *session, ChatSistOS__Message *message) {
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    answer.op = 4;
+    answer.response_status_code = 400;
+
+    SharedBuffer *delivery = pack_delivery(message);
+    if (delivery == NULL) {
+        answer.message = create_message("Error al enviar el mensaje privado");
+        send_answer(session, &answer);
+        return;
+    }
+    MailboxStatus status = MAILBOX_DELIVERED;
+    if (!deliver_if_online(message->message_destination, delivery, NULL)) {
+        status = mailbox_store(&offline_mail, message->message_destination, delivery, deliver_if_online, NULL);
+    }
+
+    char text[USER_NAME_MAX + 96];
+    switch (status) {
+    case MAILBOX_DELIVERED:
+        answer.response_status_code = 200;
+        answer.message = create_message("Mensaje privado enviado");
+        break;
+    case MAILBOX_STORED:
+        metrics_add(METRIC_OFFLINE_STORED, 1);
+        snprintf(text, sizeof(text), "El usuario %.*s no está conectado, recibirá el mensaje al volver", USER_NAME_MAX, message->message_destination);
+        answer.response_status_code = 200;
+        answer.message = create_message(text);
+        break;
+    case MAILBOX_FULL:
+        snprintf(text, sizeof(text), "El buzón de %.*s está lleno", USER_NAME_MAX, message->message_destination);
+        answer.message = create_message(text);
+        break;
+    case MAILBOX_INVALID_NAME:
+        answer.message = create_message("Nombre de usuario inválido");
+        break;
+    default:
+        answer.message = create_message("Error al enviar el mensaje privado");
+        break;
+    }
+    if (answer.response_status_code == 200) {
+        store_delivery(MESSAGE_LOG_DIRECT, message, delivery);
+    }
+    shared_buffer_unref(delivery);
+
+    send_answer(session, &answer);
+}
+
+// Op 7: rooms are created by their first join and go away with their last
+// leave
+void update_room_membership(Session *session, ChatSistOS__Room *room) {
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    answer.op = 7;
+    answer.response_status_code = 400;
+
+    RoomStatus status;
+    if (session->user_handle == USER_HANDLE_NONE) {
+        answer.message = create_message("La sesión no tiene un usuario registrado");
+        send_answer(session, &answer);
+        return;
+    }
+    if (room->join) {
+        status = rooms_join(&chat_rooms, room->room_name, session);
+    } else {
+        status = rooms_leave(&chat_rooms, room->room_name, session);
+    }
+
+    switch (status) {
+    case ROOM_OK:
+        answer.response_status_code = 200;
+        answer.message = create_message(room->join ? "Te uniste a la sala" : "Saliste de la sala");
+        break;
+    case ROOM_INVALID_NAME:
+        answer.message = create_message("Nombre de sala inválido");
+        break;
+    case ROOM_ALREADY_MEMBER:
+        answer.message = create_message("Ya estás en la sala");
+        break;
+    case ROOM_NOT_MEMBER:
+        answer.message = create_message("No estás en la sala");
+        break;
+    case ROOM_TOO_MANY:
+        answer.message = create_message("Demasiadas salas");
+        break;
+    default:
+        answer.message = create_message("Error al entrar en la sala");
+        break;
+    }
+
+    send_answer(session, &answer);
+}
+
+// Op 4 with a room as destination: only the room's members get it, and it
+// stays out of the broadcast history
+void send_room_message(Session *session, ChatSistOS__Message *message) {
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    answer.op = 4;
+    answer.response_status_code = 400;
+
+    SharedBuffer *delivery = pack_delivery(message);
+    if (delivery == NULL) {
+        answer.message = create_message("Error al enviar el mensaje a la sala");
+        send_answer(session, &answer);
+        return;
+    }
+    size_t recipients = 0;
+    RoomStatus status = rooms_send(session, message->message_destination, delivery, &recipients);
+    if (status == ROOM_OK) {
+        store_delivery(MESSAGE_LOG_ROOM, message, delivery);
+        answer.response_status_code = 200;
+        answer.message = create_message("Mensaje enviado a la sala");
+    } else {
+        answer.message = create_message("No estás en la sala");
+    }
+    send_answer(session, &answer);
+    shared_buffer_unref(delivery);
+}
+
+typedef struct HistoryHit {
+    uint64_t offset;
+    uint32_t len;
+} HistoryHit;
+
+// One op 8 read of the log. The first pass finds the matching records and
+// keeps where they are, the second copies exactly those into one buffer.
+typedef struct HistoryScan {
+    MessageLogKind kind;
+    uint32_t thread;
+    const char *room_name;
+    const char *user_name;
+    const char *peer;
+    bool newest;      // keep the last `limit` matches, not the first
+    HistoryHit *hits; // a ring of `limit` when newest
+    size_t limit;
+    size_t matched;
+    uint64_t scanned_to; // one past the last record looked at
+    // Second pass
+    SharedBuffer *batch;
+    size_t next_hit;
+    size_t filled;
+} HistoryScan;
+
+// Records only carry a hash of their conversation, so the ones that match
+// it are checked against the delivery itself before anyone is shown them
+static bool history_matches(HistoryScan *scan, const MessageLogRecord *record, const uint8_t *data) {
+    if (record->kind != scan->kind || record->thread != scan->thread) {
+        return false;
+    }
+    if (scan->kind == MESSAGE_LOG_BROADCAST) {
+        return true;
+    }
+    if (record->len < FRAME_HEADER_SIZE) {
+        return false;
+    }
+    ChatSistOS__Answer *delivery = chat_sist_os__answer__unpack(NULL, record->len - FRAME_HEADER_SIZE, data + FRAME_HEADER_SIZE);
+    if (delivery == NULL) {
+        return false;
+    }
+    const ChatSistOS__Message *message = delivery->message;
+    bool matches = false;
+    if (message != NULL && scan->kind == MESSAGE_LOG_ROOM) {
+        matches = strcmp(message->message_destination, scan->room_name) == 0;
+    } else if (message != NULL) {
+        matches = (strcmp(message->message_sender, scan->user_name) == 0 && strcmp(message->message_destination, scan->peer) == 0) ||
+                  (strcmp(message->message_sender, scan->peer) == 0 && strcmp(message->message_destination, scan->user_name) == 0);
+    }
+    chat_sist_os__answer__free_unpacked(delivery, NULL);
+    return matches;
+}
+
+static bool history_find(uint64_t offset, const MessageLogRecord *record, const uint8_t *data, void *context) {
+    HistoryScan *scan = (HistoryScan *)context;
+    scan->scanned_to = offset + 1;
+    if (!history_matches(scan, record, data)) {
+        return true;
+    }
+    HistoryHit *hit = &scan->hits[scan->newest ? scan->matched % scan->limit : scan->matched];
+    hit->offset = offset;
+    hit->len = record->len;
+    scan->matched++;
+    return scan->newest || scan->matched < scan->limit;
+}
+
+static bool history_copy(uint64_t offset, const MessageLogRecord *record, const uint8_t *data, void *context) {
+    HistoryScan *scan = (HistoryScan *)context;
+    // Hits whose segment retention dropped between the passes are skipped
+    while (scan->next_hit < scan->matched && scan->hits[scan->next_hit].offset < offset) {
+        scan->next_hit++;
+    }
+    if (scan->next_hit < scan->matched && scan->hits[scan->next_hit].offset == offset) {
+        memcpy(scan->batch->data + scan->filled, data, record->len);
+        scan->filled += record->len;
+        scan->next_hit++;
+    }
+    return scan->next_hit < scan->matched;
+}
+
+// The deliveries of one conversation from the log, framed as they were
+// sent, in one buffer; *batch is NULL if there are none. `since` is a
+// sequence number, the record's offset plus one, or 0 for the newest ones.
+// False if out of memory, leaving *cursor alone so nothing is skipped.
+static bool history_from_log(HistoryScan *scan, uint64_t since, SharedBuffer **batch, uint64_t *cursor) {
+    uint64_t first = message_log_first_offset(message_log);
+    uint64_t next = message_log_next_offset(message_log);
+    uint64_t from = since;
+    scan->newest = since == 0;
+    if (scan->newest) {
+        from = next - first > HISTORY_QUERY_SCAN ? next - HISTORY_QUERY_SCAN : first;
+    } else if (from < first) {
+        from = first;
+    }
+    scan->scanned_to = scan->newest ? next : since;
+    message_log_read(message_log, from, HISTORY_QUERY_SCAN, history_find, scan);
+    *batch = NULL;
+    if (scan->matched == 0) {
+        *cursor = scan->scanned_to;
+        return true;
+    }
+
+    // Oldest first, however the ring wrapped
+    if (scan->newest && scan->matched > scan->limit) {
+        size_t start = scan->matched % scan->limit;
+        HistoryHit *ordered = (HistoryHit *)malloc(scan->limit * sizeof(HistoryHit));
+        if (ordered == NULL) {
+            return false;
+        }
+        for (size_t i = 0; i < scan->limit; i++) {
+            ordered[i] = scan->hits[(start + i) % scan->limit];
+        }
+        free(scan->hits);
+        scan->hits = ordered;
+    }
+    if (scan->matched > scan->limit) {
+        scan->matched = scan->limit;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < scan->matched; i++) {
+        total += scan->hits[i].len;
+    }
+    scan->batch = shared_buffer_new(total);
+    if (scan->batch == NULL) {
+        return false;
+    }
+    uint64_t span = scan->hits[scan->matched - 1].offset - scan->hits[0].offset + 1;
+    message_log_read(message_log, scan->hits[0].offset, span, history_copy, scan);
+    scan->batch->len = scan->filled;
+    *batch = scan->batch;
+    *cursor = scan->scanned_to;
+    return true;
+}
+
+// Op 8: past messages of the general chat, one of the user's rooms or a
+// direct conversation, framed as deliveries and followed by an answer
+// whose cursor picks up after them. Rooms and direct messages are only
+// kept in the log; without -D the general chat comes from the ring.
+void send_history(Session *session, ChatSistOS__HistoryQuery *query) {
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    answer.op = 8;
+    answer.response_status_code = 400;
+
+    HistoryScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.kind = MESSAGE_LOG_BROADCAST;
+    scan.limit = query->limit == 0 ? HISTORY_QUERY_DEFAULT : query->limit;
+    if (scan.limit > HISTORY_QUERY_MAX) {
+        scan.limit = HISTORY_QUERY_MAX;
+    }
+    char user_name[USER_NAME_MAX + 1];
+    if (query->room_name[0] != '\0' && query->peer[0] != '\0') {
+        answer.message = create_message("Consulta de historial inválida");
+    } else if (query->room_name[0] != '\0' && !rooms_is_member(session, query->room_name)) {
+        answer.message = create_message("No estás en la sala");
+    } else if (query->peer[0] != '\0' && !registry_get(&connected_users, session->user_handle, copy_user_name, user_name)) {
+        answer.message = create_message("La sesión no tiene un usuario registrado");
+    } else if (message_log == NULL && (query->room_name[0] != '\0' || query->peer[0] != '\0')) {
+        answer.message = create_message("El historial de salas y mensajes directos necesita el registro de mensajes (-D)");
+    } else {
+        answer.response_status_code = 200;
+    }
+    if (answer.response_status_code != 200) {
+        send_answer(session, &answer);
+        return;
+    }
+
+    SharedBuffer *batch = NULL;
+    uint64_t cursor = query->since;
+    bool loaded = true;
+    if (message_log != NULL) {
+        if (query->room_name[0] != '\0') {
+            scan.kind = MESSAGE_LOG_ROOM;
+            scan.room_name = query->room_name;
+        } else if (query->peer[0] != '\0') {
+            scan.kind = MESSAGE_LOG_DIRECT;
+            scan.user_name = user_name;
+            scan.peer = query->peer;
+        }
+        scan.thread = conversation_key(scan.kind, scan.kind == MESSAGE_LOG_ROOM ? scan.room_name : user_name, scan.peer);
+        scan.hits = (HistoryHit *)malloc(scan.limit * sizeof(HistoryHit));
+        loaded = scan.hits != NULL && history_from_log(&scan, query->since, &batch, &cursor);
+        free(scan.hits);
+    } else {
+        uint64_t last = history_last_seq(&broadcast_history);
+        uint64_t from = query->since + 1;
+        if (query->since == 0) {
+            from = last >= scan.limit ? last - scan.limit + 1 : 1;
+            cursor = last;
+        }
+        batch = history_replay_from(&broadcast_history, from, scan.limit, &cursor);
+    }
+
+    if (!loaded) {
+        // The client asks again from the same place
+        answer.response_status_code = 400;
+        answer.history_cursor = query->since;
+        answer.message = create_message("Error al leer el historial");
+        send_answer(session, &answer);
+        return;
+    }
+    answer.history_cursor = cursor;
+    answer.message = create_message(batch != NULL ? "Historial enviado" : "No hay mensajes nuevos");
+    if (batch != NULL) {
+        session_enqueue(session, batch);
+        shared_buffer_unref(batch);
+    }
+    send_answer(session, &answer);
+}
+
+// Frames and packs an Answer into a buffer that can be sent to any number
+// of sessions
+SharedBuffer *pack_answer(ChatSistOS__Answer *answer) {
+    size_t packed_size = chat_sist_os__answer__get_packed_size(answer);
+    SharedBuffer *buffer = shared_buffer_new(FRAME_HEADER_SIZE + packed_size);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    frame_write_header(buffer->data, packed_size);
+    chat_sist_os__answer__pack(answer, buffer->data + FRAME_HEADER_SIZE);
 
     return buffer;
 }
 
-void handle_error(const char *message, int client_socket) {
-    perror(message);
-    close(client_socket);
+SharedBuffer *pack_delivery(ChatSistOS__Message *message) {
+    // Deliveries use the same Answer envelope as replies so a client only
+    // ever decodes one message type
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    answer.op = 4;
+    answer.response_status_code = 200;
+    answer.message = message;
+
+    return pack_answer(&answer);
 }
 
-void send_message_to_all_clients(ChatSistOS__Message *message) {
-    ConnectedUser *current_node = connected_users_head;
+// Answer with users [first, first + count) of the snapshot. The User
+// messages point into the snapshot's entries, which outlive the packing.
+SharedBuffer *pack_user_page(const RosterSnapshot *snapshot, size_t first, size_t count) {
+    ChatSistOS__User *users = NULL;
+    ChatSistOS__User **pointers = NULL;
+    if (count > 0) {
+        users = (ChatSistOS__User *)malloc(count * sizeof(ChatSistOS__User));
+        pointers = (ChatSistOS__User **)malloc(count * sizeof(ChatSistOS__User *));
+        if (users == NULL || pointers == NULL) {
+            free(users);
+            free(pointers);
+            return NULL;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        const RosterEntry *entry = &snapshot->entries[first + i];
+        chat_sist_os__user__init(&users[i]);
+        users[i].user_name = (char *)entry->user_name;
+        users[i].user_ip = (char *)entry->user_ip;
+        users[i].user_state = entry->user_state;
+        pointers[i] = &users[i];
+    }
 
-    while (current_node != NULL) {
-        send_message_to_specific_client(message, current_node);
-        current_node = current_node->next;
+    ChatSistOS__UsersOnline online = CHAT_SIST_OS__USERS_ONLINE__INIT;
+    online.n_users = count;
+    online.users = pointers;
+    online.version = snapshot->version;
+    if (count > 0 && first + count < snapshot->count) {
+        online.next_cursor = (char *)snapshot->entries[first + count - 1].user_name;
     }
+
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    answer.op = 2;
+    answer.response_status_code = 200;
+    answer.users_online = &online;
+    SharedBuffer *packed = pack_answer(&answer);
+
+    free(users);
+    free(pointers);
+
+    return packed;
 }
 
-void send_message_to_specific_client(ChatSistOS__Message *message, ConnectedUser *target_user) {
-    size_t packed_size = chat_sist_os__message__get_packed_size(message);
-    uint8_t packed[packed_size];
+// Op 3: online and busy are a CAS on the user's state; "disconnected"
+// unregisters the user but keeps the connection
+void update_user_status(Session *session, ChatSistOS__Status *status) {
+    ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+    ChatSistOS__Status current = CHAT_SIST_OS__STATUS__INIT;
+    answer.op = 3;
+
+    if (session->user_handle == USER_HANDLE_NONE) {
+        answer.response_status_code = 400;
+        answer.message = create_message("La sesión no tiene un usuario registrado");
+    } else if (status == NULL || status->user_state < USER_STATE_ONLINE || status->user_state > USER_STATE_OFFLINE) {
+        answer.response_status_code = 400;
+        answer.message = create_message("Estado inválido");
+    } else if (status->user_state == USER_STATE_OFFLINE) {
+        remove_connected_user(session);
+        answer.response_status_code = 200;
+        answer.message = create_message("Usuario desconectado");
+    } else {
+        // Whatever the user picks is no longer the idle timer's doing. Its
+        // switch takes one registry update, so waiting it out is short.
+        int away = atomic_load(&session->away);
+        while (away == SESSION_GOING_AWAY || !atomic_compare_exchange_weak(&session->away, &away, SESSION_PRESENT)) {
+            sched_yield();
+            away = atomic_load(&session->away);
+        }
+
+        char user_name[USER_NAME_MAX + 1] = "";
+        if (registry_set_state(&connected_users, session->user_handle, -1, status->user_state, user_name)) {
+            presence_status(&user_presence, user_name, status->user_state);
+        } else {
+            registry_get(&connected_users, session->user_handle, copy_user_name, user_name);
+        }
+        char *echoed_name = arena_strdup(&request_arena, user_name);
+        if (echoed_name != NULL) {
+            current.user_name = echoed_name;
+        }
+        current.user_state = status->user_state;
+        answer.response_status_code = 200;
+        answer.message = create_message("Estado actualizado");
+        answer.status = &current;
+    }
+
+    send_answer(session, &answer);
+}
 
-    chat_sist_os__message__pack(message, packed);
-    send(target_user->client_socket, packed, packed_size, 0);
+void send_answer(Session *session, ChatSistOS__Answer *answer) {
+    if (answer->response_status_code != 200) {
+        metrics_error(answer->op);
+    }
+    SharedBuffer *packed = pack_answer(answer);
+    if (packed == NULL) {
+        log_error("Error al empaquetar la respuesta: %m");
+        return;
+    }
+
+    session_enqueue(session, packed);
+    shared_buffer_unref(packed);
 }
 
 void *client_handler(void *client_data_ptr) {
-    int client_socket = ((ClientData *)client_data_ptr)->client_socket;
-    struct sockaddr_in client_addr = ((ClientData *)client_data_ptr)->client_addr;
-    
+    Session *session = session_create(((ClientData *)client_data_ptr)->client_socket, &((ClientData *)client_data_ptr)->client_addr);
     free(client_data_ptr);
+    if (session == NULL) {
+        log_error("Error al asignar memoria para la sesión del cliente: %m");
+        return NULL;
+    }
+    if (!reactor_attach(writer_loop, session)) {
+        log_error("Error al registrar el socket del cliente en epoll: %m");
+        session_close_socket(session);
+        session_unref(session);
+        return NULL;
+    }
     ssize_t len;
-    uint8_t buf[1024];
 
-    // Receive the client's message and deserialize it using protobuf
-    len = recv(client_socket, buf, sizeof(buf), 0);
-    if (len <= 0) {
-        handle_error("Error al recibir datos del cliente", client_socket);
-        remove_connected_user(client_socket);
-        return NULL;
+    // Serve the client's requests until it hangs up
+    while ((len = frame_buffer_recv(&session->in_frames, session->client_socket)) > 0) {
+        const uint8_t *payload;
+        size_t payload_len;
+        int status;
+        // Every frame this recv completed is answered with one writev
+        session_cork(session);
+        while ((status = frame_buffer_next(&session->in_frames, &payload, &payload_len)) > 0) {
+            process_request(session, payload, payload_len);
+        }
+        session_uncork(session);
+        if (status < 0) {
+            log_warn("Trama demasiado grande, cerrando la conexión");
+            break;
+        }
+    }
+    if (len < 0) {
+        log_error("Error al recibir datos del cliente: %m");
+    }
+
+    close_session(session);
+    reactor_detach(writer_loop, session);
+    session_unref(session);
+    arena_destroy(&request_arena);
+
+    return NULL;
+}
+
+// Drops the user registered on a session that is about to close
+void close_session(Session *session) {
+    presence_unsubscribe(&user_presence, session);
+    if (timer_wheel_stop(&server_timers, &session->idle_timer)) {
+        session_unref(session);
+    }
+    if (session->user_handle != USER_HANDLE_NONE) {
+        remove_connected_user(session);
+    }
+}
+
+void process_request(Session *session, const uint8_t *buf, size_t len) {
+    uint64_t started = metrics_now();
+    metrics_add(METRIC_BYTES_IN, FRAME_HEADER_SIZE + len);
+    atomic_store(&session->last_heard_ms, started / 1000000);
+
+    // Chat messages and heartbeat replies, most of the traffic, are read
+    // straight off the frame; everything else goes through protobuf-c
+    RequestView view;
+    ChatSistOS__UserOption fast_option;
+    ChatSistOS__UserOption *user_option = NULL;
+    if (request_view_decode(buf, len, &view)) {
+        user_option = request_view_option(&view, &request_arena, &fast_option);
     }
-    ChatSistOS__UserOption *user_option = chat_sist_os__user_option__unpack(NULL, len, buf);
     if (user_option == NULL) {
-        handle_error("Error al deserializar el mensaje UserOption", client_socket);
-        remove_connected_user(client_socket);
-        return NULL;
+        user_option = chat_sist_os__user_option__unpack(arena_allocator(&request_arena), len, buf);
+    }
+    if (user_option == NULL) {
+        log_warn("Error al deserializar el mensaje UserOption");
+        metrics_error(0);
+        arena_reset(&request_arena);
+        return;
+    }
+    // A pong only shows the client is alive, not that the user is there
+    if (user_option->op != SESSION_HEARTBEAT_OP) {
+        mark_session_active(session, started / 1000000);
     }
     // Check if the client's option is to create a new user
-    if (user_option->op == 1) {
-        pthread_mutex_lock(&shared_data_mutex);
+    if (user_option->op == 1 && user_option->createuser != NULL) {
         ChatSistOS__NewUser *new_user = user_option->createuser;
-        ConnectedUser *existing_connected_user = NULL;//find_user_by_name(new_user->username);
-        ChatSistOS__User *existing_user = NULL;
-
-        if (existing_connected_user != NULL) {
-            existing_user = &(existing_connected_user->user);
-        }
         ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+        bool replay = false;
+        answer.op = 1;
 
-        if (existing_user != NULL) {
+        if (session->user_handle != USER_HANDLE_NONE) {
             answer.response_status_code = 400;
-            answer.message = create_message("El usuario ya existe");
+            answer.message = create_message("La sesión ya tiene un usuario registrado");
         } else {
-            ChatSistOS__User new_user_to_add = CHAT_SIST_OS__USER__INIT;
-            new_user_to_add.user_name = new_user->username;
-            new_user_to_add.user_state = 1;
-            char client_ip[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
-            new_user_to_add.user_ip = (char *) malloc(strlen(client_ip) + 1); // Allocate memory for the IP address string
-            strcpy(new_user_to_add.user_ip, client_ip); // Copy the IP address string to the allocated memory
-
-            if (add_connected_user(&new_user_to_add, client_socket, &client_addr)) {
+            switch (add_connected_user(new_user->username, session)) {
+            case REGISTRY_OK:
                 answer.response_status_code = 200;
                 answer.message = create_message("Usuario creado exitosamente");
+                replay = true;
 
-                print_connected_users();
-            } else {
+                print_connected_user(session);
+                break;
+            case REGISTRY_EXISTS:
+                answer.response_status_code = 400;
+                answer.message = create_message("El usuario ya existe");
+                break;
+            case REGISTRY_INVALID_NAME:
+                answer.response_status_code = 400;
+                answer.message = create_message("Nombre de usuario inválido");
+                break;
+            default:
                 answer.response_status_code = 400;
                 answer.message = create_message("Error al crear el usuario");
+                break;
             }
         }
 
         // Send response to the client
-        size_t packed_size = chat_sist_os__answer__get_packed_size(&answer);
-        uint8_t packed[packed_size];
-
-        chat_sist_os__answer__pack(&answer, packed);
-        send(client_socket, packed, packed_size, 0);
-
-        free(answer.message->message_content);
-        free(answer.message);
-        pthread_mutex_unlock(&shared_data_mutex);
+        send_answer(session, &answer);
+
+        // Catch the new user up on recent broadcasts. Taken after the user
+        // joined the registry, so a broadcast racing the registration may
+        // show up twice but is never missed.
+        if (replay && history_replay_count > 0) {
+            SharedBuffer *recent = history_replay_last(&broadcast_history, history_replay_count);
+            if (recent != NULL) {
+                session_enqueue(session, recent);
+                shared_buffer_unref(recent);
+            }
+        }
+        // Then whatever was sent to them while away, all in one buffer.
+        // Taken after the user joined the registry, so a direct message
+        // racing the registration is either here or delivered directly.
+        if (replay) {
+            size_t waiting;
+            SharedBuffer *backlog = mailbox_take(&offline_mail, new_user->username, &waiting);
+            if (backlog != NULL) {
+                session_enqueue(session, backlog);
+                shared_buffer_unref(backlog);
+                metrics_add(METRIC_OFFLINE_DELIVERED, waiting);
+            }
+        }
 
-    } else if (user_option->op == 2) {
+    } else if (user_option->op == 2 && user_option->userlist != NULL) {
 
         ChatSistOS__UserList *user_list_query = user_option->userlist;
-        char *user_list;
-
-        if (user_list_query->list == false) {
-            user_list = get_user_list(false, user_list_query->user_name);
+        if (user_list_query->list) {
+            // Subscribed before the snapshot is taken, so no change falls
+            // between the two
+            if (user_list_query->subscribe && !presence_subscribe(&user_presence, session)) {
+                log_error("Error al suscribir a la sesión a los cambios de presencia: %m");
+            }
+            send_user_list(session, user_list_query);
         } else {
-            user_list = get_user_list(true, NULL);
+            send_user_info(session, user_list_query->user_name);
         }
-        ChatSistOS__Message *user_list_message = create_message(user_list);
-        ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
-        answer.response_status_code = 1;
-        answer.message = user_list_message;
-
-        // Send response to the client
-        size_t packed_size = chat_sist_os__answer__get_packed_size(&answer);
-        uint8_t packed[packed_size];
-
-        chat_sist_os__answer__pack(&answer, packed);
-        send(client_socket, packed, packed_size, 0);
-
-        free(user_list);
-        free(answer.message->message_content);
-        free(answer.message);
     } else if (user_option->op == 3) {
-        // Handle the option to disconnect a user here
-        remove_connected_user(client_socket);
-    } else if (user_option->op == 4) {
+        update_user_status(session, user_option->status);
+    } else if (user_option->op == 7 && user_option->room != NULL) {
+        update_room_membership(session, user_option->room);
+    } else if (user_option->op == 8 && user_option->history != NULL) {
+        send_history(session, user_option->history);
+    } else if (user_option->op == 4 && user_option->message != NULL) {
         ChatSistOS__Message *broadcast_message = user_option->message;
-        if (!broadcast_message->message_private) {
-            // Add the message to the broadcast messages list
-            add_broadcast_message(broadcast_message);
+        if (!stamp_sender(session, broadcast_message)) {
+            ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+            answer.op = 4;
+            answer.response_status_code = 400;
+            answer.message = create_message("La sesión no tiene un usuario registrado");
+            send_answer(session, &answer);
+        } else if (broadcast_message->message_private) {
+            send_private_message(session, broadcast_message);
+        } else if (broadcast_message->message_destination[0] != '\0') {
+            send_room_message(session, broadcast_message);
+        } else {
+            // Serialize once for the history and every recipient
+            SharedBuffer *delivery = pack_delivery(broadcast_message);
+            if (delivery == NULL) {
+                log_error("Error al serializar el mensaje de broadcast: %m");
+                metrics_error(4);
+                arena_reset(&request_arena);
+                return;
+            }
+            add_broadcast_message(delivery);
+            store_delivery(MESSAGE_LOG_BROADCAST, broadcast_message, delivery);
+            log_debug("Broadcast message: %s", broadcast_message->message_content);
 
             // Send a response to the client
             ChatSistOS__Answer answer = CHAT_SIST_OS__ANSWER__INIT;
+            answer.op = 4;
             answer.response_status_code = 200;
             answer.message = create_message("Mensaje enviado a todos los usuarios");
 
-            size_t packed_size = chat_sist_os__answer__get_packed_size(&answer);
-            uint8_t packed[packed_size];
-
-            chat_sist_os__answer__pack(&answer, packed);
-            send(client_socket, packed, packed_size, 0);
+            send_answer(session, &answer);
 
             // Send the message to all connected clients
-            send_message_to_all_clients(broadcast_message);
+            send_message_to_all_clients(delivery);
+            shared_buffer_unref(delivery);
         }
     }
-    // Cleanup and close
-    pthread_mutex_unlock(&shared_data_mutex);
-    chat_sist_os__user_option__free_unpacked(user_option, NULL);
-    close(client_socket);
-
-    return NULL;
-}
\ No newline at end of file
+    metrics_request(user_option->op, metrics_now() - started);
+    // Cleanup: the request and its answer go in one step
+    arena_reset(&request_arena);
+}
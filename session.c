@@ -0,0 +1,332 @@
+#include "session.h"
+#include "log.h"
+#include "metrics.h"
+#include "reactor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+static size_t queue_high_water = SESSION_QUEUE_HIGH_WATER;
+static size_t queue_max_messages = SESSION_QUEUE_MAX_MESSAGES;
+static QueueOverflowPolicy queue_policy = QUEUE_DROP_OLDEST;
+static TimerWheel *heartbeat_wheel = NULL;
+static uint64_t heartbeat_ms = 0;
+static SharedBuffer *heartbeat_ping = NULL;
+
+// Set once at startup, before any session exists
+void session_set_queue_limits(size_t high_water, size_t max_messages, QueueOverflowPolicy policy) {
+    queue_high_water = high_water;
+    queue_max_messages = max_messages;
+    queue_policy = policy;
+}
+
+// Set once at startup, before any session exists. The wheel pings every
+// client that has been quiet for interval_ms and hangs up on the ones that
+// stay quiet for SESSION_HEARTBEAT_MISSES intervals; 0 turns that off.
+void session_set_heartbeat(TimerWheel *wheel, uint64_t interval_ms, SharedBuffer *ping) {
+    heartbeat_wheel = wheel;
+    heartbeat_ms = interval_ms;
+    heartbeat_ping = ping;
+}
+
+// Half-open connections never fail a recv, so silence is the only sign
+// they are gone
+static void session_heartbeat_fired(TimerEntry *entry) {
+    Session *session = (Session *)((char *)entry - offsetof(Session, heartbeat_timer));
+    // A request can store a time newer than a clock read before it, so the
+    // clock is read after and a later last_heard counts as no silence
+    uint64_t last_heard_ms = atomic_load(&session->last_heard_ms);
+    uint64_t now_ms = metrics_now() / 1000000;
+    uint64_t silent = now_ms > last_heard_ms ? now_ms - last_heard_ms : 0;
+    uint64_t wait = heartbeat_ms;
+
+    if (silent >= heartbeat_ms * SESSION_HEARTBEAT_MISSES) {
+        // Wakes both the reader and the loop, which then close the session
+        pthread_mutex_lock(&session->out_mutex);
+        if (session->state != SESSION_CLOSING && !session->evicted) {
+            session->evicted = true;
+            shutdown(session->client_socket, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&session->out_mutex);
+        log_warn("Cliente sin respuesta desconectado (%llu ms sin datos)", (unsigned long long)silent);
+        metrics_add(METRIC_HEARTBEAT_TIMEOUTS, 1);
+        session_unref(session);
+        return;
+    }
+    if (silent >= heartbeat_ms) {
+        session_enqueue(session, heartbeat_ping);
+    } else {
+        wait = heartbeat_ms - silent;
+    }
+
+    if (!timer_wheel_schedule(heartbeat_wheel, entry, wait)) {
+        session_unref(session);
+    }
+}
+
+Session *session_create(int client_socket, struct sockaddr_in *client_addr) {
+    Session *session = (Session *)calloc(1, sizeof(Session));
+    if (session == NULL) {
+        return NULL;
+    }
+
+    atomic_init(&session->refs, 1);
+    session->client_socket = client_socket;
+    session->client_addr = *client_addr;
+    session->state = SESSION_OPEN;
+    frame_buffer_init(&session->in_frames);
+    if (pthread_mutex_init(&session->out_mutex, NULL) != 0) {
+        free(session);
+        return NULL;
+    }
+    if (pthread_mutex_init(&session->in_mutex, NULL) != 0) {
+        pthread_mutex_destroy(&session->out_mutex);
+        free(session);
+        return NULL;
+    }
+    metrics_add(METRIC_SESSIONS_OPENED, 1);
+
+    atomic_init(&session->last_heard_ms, metrics_now() / 1000000);
+    if (heartbeat_ms > 0) {
+        timer_entry_init(&session->heartbeat_timer, session_heartbeat_fired);
+        session_ref(session);
+        timer_wheel_schedule(heartbeat_wheel, &session->heartbeat_timer, heartbeat_ms);
+    }
+
+    return session;
+}
+
+void session_ref(Session *session) {
+    atomic_fetch_add_explicit(&session->refs, 1, memory_order_relaxed);
+}
+
+static void out_queue_pop(OutQueue *queue) {
+    SharedBuffer *buffer = queue->items[queue->head];
+    metrics_add(METRIC_DEQUEUED_MESSAGES, 1);
+    metrics_add(METRIC_DEQUEUED_BYTES, buffer->len - queue->head_offset);
+    queue->bytes -= buffer->len - queue->head_offset;
+    shared_buffer_unref(buffer);
+    queue->head = (queue->head + 1) & (queue->capacity - 1);
+    queue->count--;
+    queue->head_offset = 0;
+}
+
+// Frees the session once the owner and every in-flight sender are done
+void session_unref(Session *session) {
+    if (atomic_fetch_sub_explicit(&session->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    while (session->out_queue.count > 0) {
+        out_queue_pop(&session->out_queue);
+    }
+    free(session->out_queue.items);
+    while (session->in_head != NULL) {
+        RequestBatch *batch = session->in_head;
+        session->in_head = batch->next;
+        free(batch);
+    }
+    pthread_mutex_destroy(&session->in_mutex);
+    pthread_mutex_destroy(&session->out_mutex);
+    frame_buffer_free(&session->in_frames);
+    free(session);
+    metrics_add(METRIC_SESSIONS_CLOSED, 1);
+}
+
+// Closes the socket under out_mutex so a sender still holding a reference
+// never writes to a descriptor number the kernel has handed to someone else
+void session_close_socket(Session *session) {
+    pthread_mutex_lock(&session->out_mutex);
+    if (session->state != SESSION_CLOSING) {
+        session->state = SESSION_CLOSING;
+        if (close(session->client_socket) < 0) {
+            log_error("Error al cerrar el socket del cliente: %m");
+        }
+    }
+    pthread_mutex_unlock(&session->out_mutex);
+
+    // The caller still holds a reference, so this one is never the last
+    if (heartbeat_ms > 0 && timer_wheel_stop(heartbeat_wheel, &session->heartbeat_timer)) {
+        session_unref(session);
+    }
+}
+
+static bool out_queue_push(OutQueue *queue, SharedBuffer *buffer) {
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity > 0 ? queue->capacity * 2 : 8;
+        SharedBuffer **items = (SharedBuffer **)malloc(capacity * sizeof(SharedBuffer *));
+        if (items == NULL) {
+            return false;
+        }
+        for (size_t i = 0; i < queue->count; i++) {
+            items[i] = queue->items[(queue->head + i) & (queue->capacity - 1)];
+        }
+        free(queue->items);
+        queue->items = items;
+        queue->capacity = capacity;
+        queue->head = 0;
+    }
+
+    queue->items[(queue->head + queue->count) & (queue->capacity - 1)] = buffer;
+    queue->count++;
+    queue->bytes += buffer->len;
+    metrics_add(METRIC_QUEUED_MESSAGES, 1);
+    metrics_add(METRIC_QUEUED_BYTES, buffer->len);
+    metrics_record(METRIC_QUEUE_DEPTH, queue->count);
+
+    return true;
+}
+
+// Applies the overflow policy so that `incoming` more bytes fit. Returns
+// false if the client has to go. Called with out_mutex held. The policy is
+// about backlog: a message bigger than the high-water mark still goes out
+// to a client that keeps up.
+static bool session_make_room(Session *session, size_t incoming) {
+    OutQueue *queue = &session->out_queue;
+    if (queue->count == 0) {
+        return true;
+    }
+    if (queue->bytes + incoming <= queue_high_water && queue->count < queue_max_messages) {
+        return true;
+    }
+    if (queue_policy == QUEUE_DISCONNECT) {
+        return false;
+    }
+
+    // A partially written head has to finish or the stream would be cut
+    // mid-frame, so dropping starts right behind it
+    while ((queue->bytes + incoming > queue_high_water || queue->count >= queue_max_messages) &&
+           queue->count > (queue->head_offset > 0 ? 1u : 0u)) {
+        if (queue->head_offset > 0) {
+            size_t second = (queue->head + 1) & (queue->capacity - 1);
+            SharedBuffer *dropped = queue->items[second];
+            for (size_t i = 1; i + 1 < queue->count; i++) {
+                queue->items[(queue->head + i) & (queue->capacity - 1)] = queue->items[(queue->head + i + 1) & (queue->capacity - 1)];
+            }
+            queue->count--;
+            queue->bytes -= dropped->len;
+            metrics_add(METRIC_DEQUEUED_MESSAGES, 1);
+            metrics_add(METRIC_DEQUEUED_BYTES, dropped->len);
+            shared_buffer_unref(dropped);
+        } else {
+            out_queue_pop(queue);
+        }
+        metrics_add(METRIC_DROPPED_MESSAGES, 1);
+    }
+
+    return true;
+}
+
+// Queues a reference to buffer for this client and schedules a flush on the
+// session's I/O loop. Never blocks on the socket.
+bool session_enqueue(Session *session, SharedBuffer *buffer) {
+    bool schedule = false;
+
+    pthread_mutex_lock(&session->out_mutex);
+    if (session->state == SESSION_CLOSING || session->evicted) {
+        pthread_mutex_unlock(&session->out_mutex);
+        return false;
+    }
+    if (!session_make_room(session, buffer->len)) {
+        // Wakes both the reader and the loop, which then close the session
+        size_t queued = session->out_queue.bytes;
+        session->evicted = true;
+        shutdown(session->client_socket, SHUT_RDWR);
+        pthread_mutex_unlock(&session->out_mutex);
+        log_warn("Cliente lento desconectado (%zu bytes en cola)", queued);
+        metrics_add(METRIC_EVICTIONS, 1);
+        return false;
+    }
+    if (!out_queue_push(&session->out_queue, buffer)) {
+        pthread_mutex_unlock(&session->out_mutex);
+        return false;
+    }
+    shared_buffer_ref(buffer);
+    if (!session->flush_scheduled && !session->corked) {
+        session->flush_scheduled = true;
+        schedule = true;
+    }
+    pthread_mutex_unlock(&session->out_mutex);
+
+    if (schedule) {
+        reactor_schedule_flush(session->loop, session);
+    }
+
+    return true;
+}
+
+// Writes queued buffers with writev until the queue is empty or the socket
+// would block. Runs on the session's I/O loop. Returns false if the
+// connection failed.
+bool session_flush(Session *session) {
+    OutQueue *queue = &session->out_queue;
+    struct iovec iov[SESSION_WRITEV_BATCH];
+    bool ok = true;
+
+    pthread_mutex_lock(&session->out_mutex);
+    session->flush_scheduled = false;
+    while (session->state != SESSION_CLOSING && queue->count > 0) {
+        size_t n = queue->count < SESSION_WRITEV_BATCH ? queue->count : SESSION_WRITEV_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            SharedBuffer *buffer = queue->items[(queue->head + i) & (queue->capacity - 1)];
+            size_t offset = i == 0 ? queue->head_offset : 0;
+            iov[i].iov_base = buffer->data + offset;
+            iov[i].iov_len = buffer->len - offset;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t sent = sendmsg(session->client_socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN: the loop flushes again on the next EPOLLOUT edge
+            ok = errno == EAGAIN || errno == EWOULDBLOCK;
+            break;
+        }
+
+        size_t left = (size_t)sent;
+        metrics_add(METRIC_BYTES_OUT, left);
+        while (left > 0) {
+            size_t head_left = queue->items[queue->head]->len - queue->head_offset;
+            if (left < head_left) {
+                queue->head_offset += left;
+                queue->bytes -= left;
+                metrics_add(METRIC_DEQUEUED_BYTES, left);
+                break;
+            }
+            left -= head_left;
+            out_queue_pop(queue);
+        }
+    }
+    pthread_mutex_unlock(&session->out_mutex);
+
+    return ok;
+}
+
+// Held while a reader dispatches every frame of one recv: replies to its
+// own session pile up in the queue instead of each waking the loop
+void session_cork(Session *session) {
+    pthread_mutex_lock(&session->out_mutex);
+    session->corked = true;
+    pthread_mutex_unlock(&session->out_mutex);
+}
+
+// Writes everything the batch produced with as few writev calls as the
+// socket allows, right from the reader. Returns false if the connection
+// failed.
+bool session_uncork(Session *session) {
+    pthread_mutex_lock(&session->out_mutex);
+    session->corked = false;
+    bool pending = session->out_queue.count > 0 && !session->flush_scheduled;
+    pthread_mutex_unlock(&session->out_mutex);
+
+    return pending ? session_flush(session) : true;
+}
@@ -0,0 +1,119 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "framing.h"
+#include "registry.h"
+#include "shared_buffer.h"
+#include "timer_wheel.h"
+
+#define SESSION_QUEUE_HIGH_WATER (4 * 1024 * 1024)
+#define SESSION_QUEUE_MAX_MESSAGES 4096
+#define SESSION_WRITEV_BATCH 1024 // IOV_MAX on Linux
+// Answer.op of a ping sent to a client that has gone quiet, and
+// UserOption.op of its reply
+#define SESSION_HEARTBEAT_OP 6
+// Pings a client may leave unanswered before it is taken for dead
+#define SESSION_HEARTBEAT_MISSES 3
+#define SESSION_MAX_ROOMS 16
+
+// Session.away
+#define SESSION_PRESENT 0
+#define SESSION_GOING_AWAY 1 // the idle timer is switching the state
+#define SESSION_AWAY 2       // busy because idle, not because the user said so
+
+struct ReactorLoop;
+struct Room;
+
+typedef enum SessionState {
+    SESSION_OPEN,
+    SESSION_CLOSING
+} SessionState;
+
+// What to do when a client reads slower than it is sent to
+typedef enum QueueOverflowPolicy {
+    QUEUE_DROP_OLDEST, // drop the oldest queued messages to make room
+    QUEUE_DISCONNECT   // evict the client
+} QueueOverflowPolicy;
+
+// Bounded FIFO of buffers waiting to be written to one client. Only the
+// buffer at head can be partially sent (head_offset bytes of it).
+typedef struct OutQueue {
+    SharedBuffer **items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t head_offset;
+    size_t bytes;
+} OutQueue;
+
+// Complete frames, still in wire format, copied out of the read buffer for
+// a pool worker to decode
+typedef struct RequestBatch {
+    struct RequestBatch *next;
+    size_t len;
+    uint8_t data[];
+} RequestBatch;
+
+// A client connection, shared by the threaded and the epoll server modes.
+// It lives for as long as the TCP connection and carries every request the
+// client makes, from registration to its last message.
+typedef struct Session {
+    atomic_int refs; // the owning thread holds one; senders take more while queuing
+    int client_socket;
+    struct sockaddr_in client_addr;
+    SessionState state;
+    bool threaded; // requests are read on a dedicated thread, not on the loop
+    struct ReactorLoop *loop; // the I/O loop that writes the session's output
+    size_t loop_slot;         // index in the loop's member list
+    UserHandle user_handle; // set once the client registers (op 1)
+    FrameBuffer in_frames;
+    // Output any thread may queue to, guarded by out_mutex
+    pthread_mutex_t out_mutex;
+    OutQueue out_queue;
+    bool flush_scheduled;
+    bool corked; // the reader is mid-batch; it flushes once it is done
+    bool evicted;
+    // Requests waiting for a pool worker in arrival order, guarded by
+    // in_mutex. Only one worker runs a session at a time.
+    pthread_mutex_t in_mutex;
+    RequestBatch *in_head;
+    RequestBatch *in_tail;
+    bool dispatched; // queued on or running in a worker
+    bool in_closed;  // the loop closed it; the worker calls on_close last
+    // Presence subscription, guarded by the Presence mutex
+    bool presence_subscribed;
+    size_t presence_slot;
+    // Auto-away: the timer checks last_active_ms and moves the user in
+    // idle_handle from online to busy; the next request moves them back
+    TimerEntry idle_timer;
+    _Atomic UserHandle idle_handle;
+    _Atomic uint64_t last_active_ms;
+    atomic_int away; // SESSION_PRESENT, SESSION_GOING_AWAY or SESSION_AWAY
+    // Liveness: any frame from the client, pongs included, moves
+    // last_heard_ms; the heartbeat timer pings or hangs up on silence
+    TimerEntry heartbeat_timer;
+    _Atomic uint64_t last_heard_ms;
+    // Rooms the session has joined; only the thread running its requests
+    // and its close touches them
+    struct Room *rooms[SESSION_MAX_ROOMS];
+    size_t room_count;
+} Session;
+
+void session_set_queue_limits(size_t high_water, size_t max_messages, QueueOverflowPolicy policy);
+void session_set_heartbeat(TimerWheel *wheel, uint64_t interval_ms, SharedBuffer *ping);
+Session *session_create(int client_socket, struct sockaddr_in *client_addr);
+void session_ref(Session *session);
+void session_unref(Session *session);
+void session_close_socket(Session *session);
+bool session_enqueue(Session *session, SharedBuffer *buffer);
+bool session_flush(Session *session);
+void session_cork(Session *session);
+bool session_uncork(Session *session);
+
+#endif
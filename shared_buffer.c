@@ -0,0 +1,26 @@
+#include "shared_buffer.h"
+#include <stdlib.h>
+
+// The caller fills data[0..len) before sharing the buffer with other threads
+SharedBuffer *shared_buffer_new(size_t len) {
+    SharedBuffer *buffer = (SharedBuffer *)malloc(sizeof(SharedBuffer) + len);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    atomic_init(&buffer->refs, 1);
+    buffer->len = len;
+    buffer->data = buffer->bytes;
+
+    return buffer;
+}
+
+void shared_buffer_ref(SharedBuffer *buffer) {
+    atomic_fetch_add_explicit(&buffer->refs, 1, memory_order_relaxed);
+}
+
+void shared_buffer_unref(SharedBuffer *buffer) {
+    if (atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel) == 1) {
+        free(buffer);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef SHARED_BUFFER_H
+#define SHARED_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Immutable, reference-counted bytes. A message is serialized into one of
+// these once and the same buffer is then handed to every recipient; the
+// bytes are freed when the last recipient drops its reference.
+typedef struct SharedBuffer {
+    atomic_int refs;
+    size_t len;
+    uint8_t *data;
+    uint8_t bytes[];
+} SharedBuffer;
+
+SharedBuffer *shared_buffer_new(size_t len);
+void shared_buffer_ref(SharedBuffer *buffer);
+void shared_buffer_unref(SharedBuffer *buffer);
+
+#endif
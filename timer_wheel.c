@@ -0,0 +1,169 @@
+#include "timer_wheel.h"
+#include <string.h>
+#include <time.h>
+
+static uint64_t timer_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void timer_unlink(TimerEntry *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = entry->prev = entry;
+    entry->armed = false;
+}
+
+void timer_entry_init(TimerEntry *entry, TimerCallback fire) {
+    entry->next = entry->prev = entry;
+    entry->deadline = 0;
+    entry->armed = false;
+    entry->stopped = false;
+    entry->fire = fire;
+}
+
+// Puts an unlinked entry in the slot its deadline falls in, on the lowest
+// level that reaches that far. Called with the mutex held.
+static void timer_wheel_insert(TimerWheel *wheel, TimerEntry *entry) {
+    uint64_t delta = entry->deadline - wheel->now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> (TIMER_WHEEL_LEVEL_BITS * (level + 1)) != 0) {
+        level++;
+    }
+    size_t slot = (entry->deadline >> (TIMER_WHEEL_LEVEL_BITS * level)) & (TIMER_WHEEL_LEVEL_SLOTS - 1);
+
+    TimerEntry *head = &wheel->slots[level][slot];
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+    entry->armed = true;
+}
+
+bool timer_wheel_schedule(TimerWheel *wheel, TimerEntry *entry, uint64_t delay_ms) {
+    // Never due on the tick being walked: at least one tick from now
+    uint64_t ticks = (delay_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    uint64_t max_ticks = ((uint64_t)1 << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    if (ticks == 0) {
+        ticks = 1;
+    } else if (ticks > max_ticks) {
+        ticks = max_ticks;
+    }
+
+    pthread_mutex_lock(&wheel->mutex);
+    if (entry->stopped) {
+        pthread_mutex_unlock(&wheel->mutex);
+        return false;
+    }
+    if (entry->armed) {
+        timer_unlink(entry);
+    }
+    entry->deadline = wheel->now + ticks;
+    timer_wheel_insert(wheel, entry);
+    pthread_mutex_unlock(&wheel->mutex);
+
+    return true;
+}
+
+bool timer_wheel_stop(TimerWheel *wheel, TimerEntry *entry) {
+    pthread_mutex_lock(&wheel->mutex);
+    bool armed = entry->armed;
+    if (armed) {
+        timer_unlink(entry);
+    }
+    entry->stopped = true;
+    pthread_mutex_unlock(&wheel->mutex);
+
+    return armed;
+}
+
+// Spreads one slot of an upper level over the levels below it, now that
+// the wheel has come within that level's reach of its deadlines
+static void timer_wheel_cascade(TimerWheel *wheel, int level) {
+    size_t slot = (wheel->now >> (TIMER_WHEEL_LEVEL_BITS * level)) & (TIMER_WHEEL_LEVEL_SLOTS - 1);
+    TimerEntry *head = &wheel->slots[level][slot];
+
+    TimerEntry *entry = head->next;
+    while (entry != head) {
+        TimerEntry *next = entry->next;
+        timer_unlink(entry);
+        timer_wheel_insert(wheel, entry);
+        entry = next;
+    }
+}
+
+// Advances one tick and moves the entries due on it onto the returned chain
+static TimerEntry *timer_wheel_advance(TimerWheel *wheel) {
+    wheel->now++;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if ((wheel->now >> (TIMER_WHEEL_LEVEL_BITS * (level - 1))) & (TIMER_WHEEL_LEVEL_SLOTS - 1)) {
+            break;
+        }
+        timer_wheel_cascade(wheel, level);
+    }
+
+    // Everything left in a level 0 slot is due on this very tick
+    TimerEntry *head = &wheel->slots[0][wheel->now & (TIMER_WHEEL_LEVEL_SLOTS - 1)];
+    TimerEntry *due = NULL;
+    while (head->next != head) {
+        TimerEntry *entry = head->next;
+        timer_unlink(entry);
+        entry->next_due = due;
+        due = entry;
+    }
+
+    return due;
+}
+
+static void *timer_wheel_thread(void *wheel_ptr) {
+    TimerWheel *wheel = (TimerWheel *)wheel_ptr;
+    struct timespec tick = { 0, TIMER_WHEEL_TICK_MS * 1000000L };
+    uint64_t started = timer_clock_ms();
+
+    while (1) {
+        nanosleep(&tick, NULL);
+
+        // Catch up on every tick the clock says has passed, so a late
+        // wake-up delays timers without skipping them
+        uint64_t target = (timer_clock_ms() - started) / TIMER_WHEEL_TICK_MS;
+        while (1) {
+            pthread_mutex_lock(&wheel->mutex);
+            if (wheel->now >= target) {
+                pthread_mutex_unlock(&wheel->mutex);
+                break;
+            }
+            TimerEntry *due = timer_wheel_advance(wheel);
+            pthread_mutex_unlock(&wheel->mutex);
+
+            while (due != NULL) {
+                TimerEntry *entry = due;
+                due = entry->next_due;
+                entry->fire(entry);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+bool timer_wheel_start(TimerWheel *wheel) {
+    memset(wheel, 0, sizeof(*wheel));
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (size_t i = 0; i < TIMER_WHEEL_LEVEL_SLOTS; i++) {
+            TimerEntry *head = &wheel->slots[level][i];
+            head->next = head->prev = head;
+        }
+    }
+    if (pthread_mutex_init(&wheel->mutex, NULL) != 0) {
+        return false;
+    }
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, timer_wheel_thread, wheel) != 0) {
+        return false;
+    }
+    pthread_detach(thread_id);
+
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define TIMER_WHEEL_TICK_MS 100
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_LEVEL_SLOTS (1 << TIMER_WHEEL_LEVEL_BITS)
+// 64^4 ticks of 100 ms is about 19 days; longer delays are cut to that
+#define TIMER_WHEEL_LEVELS 4
+
+struct TimerEntry;
+// Runs on the wheel's thread with no lock held; it may schedule the entry
+// again
+typedef void (*TimerCallback)(struct TimerEntry *entry);
+
+// Embedded in whatever the timer is for, so arming one never allocates
+typedef struct TimerEntry {
+    struct TimerEntry *next;
+    struct TimerEntry *prev;
+    struct TimerEntry *next_due; // chain of entries being fired, wheel thread only
+    uint64_t deadline; // in ticks
+    bool armed;
+    bool stopped; // timer_wheel_stop was called; it never fires again
+    TimerCallback fire;
+} TimerEntry;
+
+// Hierarchical timing wheel walked by one thread every TIMER_WHEEL_TICK_MS.
+// Level 0 has a slot per tick; each level above has slots 64 times as wide.
+// A timer goes to the lowest level whose turn still covers its deadline and
+// moves down a level each time the level below wraps around to it, so
+// nothing is looked at more than TIMER_WHEEL_LEVELS times however far out it
+// is. Arming, re-arming and cancelling are O(1) under one mutex, so a few
+// timers per session are cheap where a thread or a sleeping task per
+// session is not.
+typedef struct TimerWheel {
+    pthread_mutex_t mutex;
+    TimerEntry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_LEVEL_SLOTS]; // list heads
+    uint64_t now; // ticks since start
+} TimerWheel;
+
+bool timer_wheel_start(TimerWheel *wheel);
+void timer_entry_init(TimerEntry *entry, TimerCallback fire);
+// (Re)arms the entry to fire in delay_ms. An armed entry holds whatever
+// its owner gave it, typically a reference, until it fires, is stopped, or
+// this returns false because it was stopped: then the caller takes that
+// back.
+bool timer_wheel_schedule(TimerWheel *wheel, TimerEntry *entry, uint64_t delay_ms);
+// Disarms the entry for good. True if it was armed, i.e. it will not fire
+// and its owner gets back whatever the armed timer held; false if it had
+// already fired (its callback may still be running).
+bool timer_wheel_stop(TimerWheel *wheel, TimerEntry *entry);
+
+#endif
@@ -0,0 +1,231 @@
+#include "workpool.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool work_deque_push(WorkDeque *deque, Session *session) {
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->count == deque->capacity) {
+        size_t capacity = deque->capacity > 0 ? deque->capacity * 2 : WORKPOOL_DEQUE_INITIAL;
+        Session **items = (Session **)malloc(capacity * sizeof(Session *));
+        if (items == NULL) {
+            pthread_mutex_unlock(&deque->mutex);
+            return false;
+        }
+        for (size_t i = 0; i < deque->count; i++) {
+            items[i] = deque->items[(deque->head + i) & (deque->capacity - 1)];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->capacity = capacity;
+        deque->head = 0;
+    }
+    deque->items[(deque->head + deque->count) & (deque->capacity - 1)] = session;
+    deque->count++;
+    pthread_mutex_unlock(&deque->mutex);
+
+    return true;
+}
+
+static Session *work_deque_take(WorkDeque *deque, bool steal) {
+    Session *session = NULL;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->count > 0) {
+        deque->count--;
+        if (steal) {
+            session = deque->items[(deque->head + deque->count) & (deque->capacity - 1)];
+        } else {
+            session = deque->items[deque->head];
+            deque->head = (deque->head + 1) & (deque->capacity - 1);
+        }
+    }
+    pthread_mutex_unlock(&deque->mutex);
+
+    return session;
+}
+
+// Hands a dispatched session, and the reference that comes with it, to a
+// worker
+static void workpool_push(WorkPool *pool, Session *session) {
+    unsigned index = atomic_fetch_add_explicit(&pool->next_deque, 1, memory_order_relaxed) % (unsigned)pool->worker_count;
+    while (!work_deque_push(&pool->deques[index], session)) {
+        usleep(1000);
+    }
+
+    // Pairs with the sleeper check in workpool_next: either the worker sees
+    // the new item or this sees the sleeper and wakes it
+    atomic_fetch_add(&pool->pending, 1);
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->idle_mutex);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+}
+
+// Own deque first, then steal from the others, then sleep
+static Session *workpool_next(WorkPool *pool, int self) {
+    while (1) {
+        for (int i = 0; i < pool->worker_count; i++) {
+            int victim = (self + i) % pool->worker_count;
+            Session *session = work_deque_take(&pool->deques[victim], i > 0);
+            if (session != NULL) {
+                atomic_fetch_sub(&pool->pending, 1);
+                return session;
+            }
+        }
+
+        pthread_mutex_lock(&pool->idle_mutex);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while (atomic_load(&pool->pending) == 0) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_mutex);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+}
+
+// One turn of a session: every batch that arrived since its last turn, in
+// order, answered with one writev. Requests that arrive meanwhile wait for
+// the next turn, so a busy client cannot hold a worker forever.
+static void workpool_run_session(WorkPool *pool, Session *session) {
+    pthread_mutex_lock(&session->in_mutex);
+    RequestBatch *batch = session->in_head;
+    bool closed = session->in_closed;
+    session->in_head = NULL;
+    session->in_tail = NULL;
+    pthread_mutex_unlock(&session->in_mutex);
+
+    session_cork(session);
+    while (batch != NULL) {
+        FrameBuffer frames = { batch->data, batch->len, 0, batch->len };
+        const uint8_t *payload;
+        size_t payload_len;
+        while (frame_buffer_next(&frames, &payload, &payload_len) > 0) {
+            pool->on_request(session, payload, payload_len);
+        }
+        RequestBatch *done = batch;
+        batch = batch->next;
+        free(done);
+    }
+    // A failed write shows up on the loop as an error on the socket
+    session_uncork(session);
+
+    if (closed) {
+        pool->on_close(session);
+        session_unref(session);
+        return;
+    }
+
+    pthread_mutex_lock(&session->in_mutex);
+    bool again = session->in_head != NULL || session->in_closed;
+    session->dispatched = again;
+    pthread_mutex_unlock(&session->in_mutex);
+
+    if (again) {
+        workpool_push(pool, session);
+    } else {
+        session_unref(session);
+    }
+}
+
+static void *workpool_thread(void *deque_ptr) {
+    WorkDeque *deque = (WorkDeque *)deque_ptr;
+    WorkPool *pool = deque->pool;
+    int self = (int)(deque - pool->deques);
+
+    while (1) {
+        workpool_run_session(pool, workpool_next(pool, self));
+    }
+
+    return NULL;
+}
+
+// Queues the session unless it already is; called with in_mutex held
+static bool workpool_dispatch_locked(Session *session) {
+    if (session->dispatched) {
+        return false;
+    }
+    session->dispatched = true;
+    session_ref(session);
+
+    return true;
+}
+
+bool workpool_submit(WorkPool *pool, Session *session, const uint8_t *frames, size_t len) {
+    RequestBatch *batch = (RequestBatch *)malloc(sizeof(RequestBatch) + len);
+    if (batch == NULL) {
+        return false;
+    }
+    batch->next = NULL;
+    batch->len = len;
+    memcpy(batch->data, frames, len);
+
+    pthread_mutex_lock(&session->in_mutex);
+    if (session->in_tail != NULL) {
+        session->in_tail->next = batch;
+    } else {
+        session->in_head = batch;
+    }
+    session->in_tail = batch;
+    bool dispatch = workpool_dispatch_locked(session);
+    pthread_mutex_unlock(&session->in_mutex);
+
+    if (dispatch) {
+        workpool_push(pool, session);
+    }
+
+    return true;
+}
+
+void workpool_close(WorkPool *pool, Session *session) {
+    pthread_mutex_lock(&session->in_mutex);
+    session->in_closed = true;
+    bool dispatch = workpool_dispatch_locked(session);
+    pthread_mutex_unlock(&session->in_mutex);
+
+    if (dispatch) {
+        workpool_push(pool, session);
+    }
+}
+
+bool workpool_start(WorkPool *pool, int workers, ReactorRequestHandler on_request, ReactorCloseHandler on_close) {
+    memset(pool, 0, sizeof(*pool));
+    pool->worker_count = workers;
+    pool->on_request = on_request;
+    pool->on_close = on_close;
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->next_deque, 0);
+    atomic_init(&pool->sleepers, 0);
+    if (pthread_mutex_init(&pool->idle_mutex, NULL) != 0 || pthread_cond_init(&pool->idle_cond, NULL) != 0) {
+        perror("Error al inicializar la sincronización del pool de trabajo");
+        return false;
+    }
+
+    pool->deques = (WorkDeque *)aligned_alloc(64, (size_t)workers * sizeof(WorkDeque));
+    pool->threads = (pthread_t *)calloc((size_t)workers, sizeof(pthread_t));
+    if (pool->deques == NULL || pool->threads == NULL) {
+        perror("Error al asignar memoria para el pool de trabajo");
+        return false;
+    }
+    memset(pool->deques, 0, (size_t)workers * sizeof(WorkDeque));
+    for (int i = 0; i < workers; i++) {
+        pool->deques[i].pool = pool;
+        if (pthread_mutex_init(&pool->deques[i].mutex, NULL) != 0) {
+            perror("Error al inicializar la cola del pool de trabajo");
+            return false;
+        }
+    }
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&pool->threads[i], NULL, workpool_thread, &pool->deques[i]) != 0) {
+            perror("Error al crear el hilo de trabajo");
+            return false;
+        }
+    }
+
+    log_info("Pool de trabajo con %d hilo(s)", workers);
+
+    return true;
+}
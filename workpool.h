@@ -0,0 +1,48 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "reactor.h"
+#include "session.h"
+
+#define WORKPOOL_DEQUE_INITIAL 64
+
+// One worker's run queue of sessions with requests waiting. The owner takes
+// from the head; idle workers steal from the tail.
+typedef struct WorkDeque {
+    struct WorkPool *pool;
+    pthread_mutex_t mutex;
+    Session **items;
+    size_t head;
+    size_t count;
+    size_t capacity; // power of two
+} __attribute__((aligned(64))) WorkDeque;
+
+// Work-stealing pool that decodes and handles requests off the I/O loops.
+// The loops only read and split frames; a session is queued on one worker
+// at a time, so its requests are handled in the order they arrived.
+typedef struct WorkPool {
+    int worker_count;
+    WorkDeque *deques;
+    pthread_t *threads;
+    ReactorRequestHandler on_request;
+    ReactorCloseHandler on_close;
+
+    atomic_size_t pending; // sessions sitting in the deques
+    atomic_uint next_deque;
+    atomic_int sleepers;
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;
+} WorkPool;
+
+bool workpool_start(WorkPool *pool, int workers, ReactorRequestHandler on_request, ReactorCloseHandler on_close);
+// Copies `len` bytes of complete frames for the session's next turn
+bool workpool_submit(WorkPool *pool, Session *session, const uint8_t *frames, size_t len);
+// The loop is done with the session: on_close runs after its last request
+void workpool_close(WorkPool *pool, Session *session);
+
+#endif